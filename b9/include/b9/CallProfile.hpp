@@ -0,0 +1,97 @@
+#if !defined(B9_CALLPROFILE_HPP_)
+#define B9_CALLPROFILE_HPP_
+
+#include <b9/Module.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace b9 {
+
+/// Call counts and times for each function, and the count of each edge in the
+/// call graph. Every call that enters ExecutionContext::interpret is measured:
+/// interpreted calls, calls from the interpreter into compiled code, and calls
+/// from compiled code back into the interpreter.
+///
+/// A function's inclusive time counts from when its outermost active call
+/// starts until it returns, so recursion isn't counted twice. Its exclusive
+/// time leaves out the time spent in measured callees.
+class CallProfile {
+ public:
+  /// The caller of calls from native code, such as VirtualMachine::run.
+  static constexpr std::size_t ROOT = SIZE_MAX;
+
+  using Clock = std::chrono::steady_clock;
+
+  /// Measures one call for as long as it lives. Does nothing if profile is
+  /// nullptr.
+  class Call {
+   public:
+    Call(CallProfile *profile, std::size_t functionIndex) : profile_(profile) {
+      if (profile_) profile_->enter(functionIndex);
+    }
+
+    ~Call() {
+      if (profile_) profile_->exit();
+    }
+
+    Call(const Call &) = delete;
+    Call &operator=(const Call &) = delete;
+
+   private:
+    CallProfile *profile_;
+  };
+
+  std::uint64_t calls(std::size_t functionIndex) const;
+
+  /// Inclusive time, in nanoseconds.
+  std::uint64_t inclusive(std::size_t functionIndex) const;
+
+  /// Exclusive time, in nanoseconds.
+  std::uint64_t exclusive(std::size_t functionIndex) const;
+
+  /// The number of calls from caller to callee. The caller may be ROOT.
+  std::uint64_t edgeCount(std::size_t caller, std::size_t callee) const;
+
+  /// Print the functions, most exclusive time first, then the call graph
+  /// edges, most calls first.
+  void print(std::ostream &out, const Module &module) const;
+
+ private:
+  struct Function {
+    std::uint64_t calls = 0;
+    std::uint64_t inclusive = 0;
+    std::uint64_t exclusive = 0;
+    std::size_t active = 0;  //< Calls on the stack
+  };
+
+  struct Active {
+    std::size_t functionIndex;
+    Clock::time_point start;
+    std::uint64_t callees;  //< Time spent in measured callees
+  };
+
+  void enter(std::size_t functionIndex);
+
+  void exit();
+
+  Function &function(std::size_t functionIndex) {
+    if (functionIndex >= functions_.size()) {
+      functions_.resize(functionIndex + 1);
+    }
+    return functions_[functionIndex];
+  }
+
+  std::vector<Function> functions_;
+  std::map<std::pair<std::size_t, std::size_t>, std::uint64_t> edges_;
+  std::vector<Active> stack_;
+};
+
+}  // namespace b9
+
+#endif  // B9_CALLPROFILE_HPP_
@@ -0,0 +1,70 @@
+#if !defined(B9_CALLSTACK_HPP_)
+#define B9_CALLSTACK_HPP_
+
+#include <b9/OperandStack.hpp>
+#include <b9/ThreadedCode.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+
+namespace b9 {
+
+/// Thrown when calls nest deeper than the VM allows.
+struct StackOverflowException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// The record of an interpreted function activation.
+struct Frame {
+  std::size_t functionIndex;
+  StackElement *params;
+  StackElement *locals;
+  /// The caller's next instruction. Null when the caller is native code.
+  const ThreadedInstruction *returnAddress;
+};
+
+/// The frames of the threaded interpreter. Interpreted calls push a Frame
+/// here, rather than recursing on the native stack.
+class CallStack {
+ public:
+  explicit CallStack(std::size_t capacity)
+      : frames_(new Frame[capacity]),
+        top_(frames_.get()),
+        end_(frames_.get() + capacity) {}
+
+  void reset() { top_ = frames_.get(); }
+
+  void push(const Frame &frame) {
+    if (top_ == end_) {
+      throw StackOverflowException{"Call stack overflow"};
+    }
+    *top_ = frame;
+    ++top_;
+  }
+
+  Frame pop() {
+    --top_;
+    return *top_;
+  }
+
+  Frame &top() { return *(top_ - 1); }
+
+  std::size_t depth() const { return top_ - frames_.get(); }
+
+  /// Discard every frame above depth.
+  void unwind(std::size_t depth) { top_ = frames_.get() + depth; }
+
+  const Frame *begin() const { return frames_.get(); }
+
+  const Frame *end() const { return top_; }
+
+ private:
+  std::unique_ptr<Frame[]> frames_;
+  Frame *top_;
+  Frame *end_;
+};
+
+}  // namespace b9
+
+#endif  // B9_CALLSTACK_HPP_
@@ -0,0 +1,78 @@
+#if !defined(B9_COMPILEQUEUE_HPP_)
+#define B9_COMPILEQUEUE_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+namespace b9 {
+
+/// Timing and depth counters for a CompileQueue.
+struct CompileStatistics {
+  std::uint64_t requests = 0;                //< Functions queued
+  std::uint64_t completed = 0;               //< Functions compiled
+  std::size_t maxDepth = 0;                  //< Most requests waiting at once
+  std::chrono::nanoseconds totalLatency{0};  //< From request to installation
+  std::chrono::nanoseconds maxLatency{0};    //< From request to installation
+};
+
+std::ostream &operator<<(std::ostream &out, const CompileStatistics &stats);
+
+/// A queue of functions waiting to be compiled, serviced by a single
+/// background thread. The compile function is run on the background thread,
+/// and is responsible for installing the code it generates. Requests are
+/// compiled in the order they are made.
+class CompileQueue {
+ public:
+  using CompileFunction = std::function<void(std::size_t functionIndex)>;
+
+  explicit CompileQueue(CompileFunction compile);
+
+  /// Stops the background thread. Requests still in the queue are dropped.
+  ~CompileQueue() noexcept;
+
+  CompileQueue(const CompileQueue &) = delete;
+
+  CompileQueue &operator=(const CompileQueue &) = delete;
+
+  /// Queue a function for compilation. Returns immediately.
+  void request(std::size_t functionIndex);
+
+  /// Block until every queued request has been compiled.
+  void drain();
+
+  /// The number of requests waiting, not counting one being compiled.
+  std::size_t depth() const;
+
+  CompileStatistics statistics() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Request {
+    std::size_t functionIndex;
+    Clock::time_point requested;
+  };
+
+  void run();
+
+  CompileFunction compile_;
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  std::deque<Request> requests_;
+  bool busy_ = false;
+  bool stopping_ = false;
+  CompileStatistics statistics_;
+  std::thread thread_;
+};
+
+}  // namespace b9
+
+#endif  // B9_COMPILEQUEUE_HPP_
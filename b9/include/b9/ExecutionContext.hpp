@@ -1,7 +1,9 @@
 #if !defined(B9_EXECUTIONCONTEXT_HPP_)
 #define B9_EXECUTIONCONTEXT_HPP_
 
+#include <b9/CallStack.hpp>
 #include <b9/OperandStack.hpp>
+#include <b9/Trace.hpp>
 #include <b9/VirtualMachine.hpp>
 
 #include <iostream>
@@ -22,6 +24,13 @@ class ExecutionContext {
 
   const OperandStack &stack() const { return stack_; }
 
+  const CallStack &callStack() const { return callStack_; }
+
+  /// The innermost frame the sampling profiler can see, or nullptr.
+  const std::atomic<const ShadowFrame *> &shadowFrames() const {
+    return shadowTop_;
+  }
+
   template <typename VisitorT>
   void visit(VisitorT &visitor) {
     stack_.visit(visitor);
@@ -38,6 +47,30 @@ class ExecutionContext {
   // Available externally for jit-to-primitive calls.
   void doPrimitiveCall(Immediate value);
 
+  // Available externally for the jit's object operations.
+  void doNewObject();
+
+  /// Object accesses through an inline cache.
+  void doPushFromObject(PropertyCache &cache);
+
+  void doPopIntoObject(PropertyCache &cache);
+
+  void doCallIndirect();
+
+  void doSystemCollect();
+
+  /// Compare two values as the conditional jump op would. Available
+  /// externally for compiled code that doesn't speculate.
+  bool doCompare(OpCode op, StackElement left, StackElement right);
+
+  /// Continue a compiled frame in the interpreter, at bytecodeIndex. Used when
+  /// a speculation in compiled code fails. The compiled code leaves its
+  /// operand stack at operandBase, followed by its params and locals. The
+  /// arguments the frame was called with start at stackBase, and are popped
+  /// on return, as compiled code would.
+  StackElement resume(std::size_t functionIndex, std::size_t bytecodeIndex,
+                      StackElement *stackBase, StackElement *operandBase);
+
   friend std::ostream &operator<<(std::ostream &stream,
                                   const ExecutionContext &ec);
 
@@ -45,10 +78,54 @@ class ExecutionContext {
   friend class VirtualMachine;
   friend class ExecutionContextOffset;
 
+#if defined(B9_COMPUTED_GOTO)
+  /// The threaded interpreter. Each handler ends in its own indirect jump to
+  /// the next handler, rather than sharing the single branch of a switch.
+  /// Functions are run from pre-decoded ThreadedCode, which is translated on
+  /// first call and cached by the VirtualMachine. The top of the operand stack
+  /// is kept in a local, and only written back to the OperandStack at calls,
+  /// primitive calls and allocations, which is where the GC may visit it.
+  /// Interpreted calls push a Frame onto the CallStack and continue in the
+  /// same loop, rather than recursing.
+  StackElement interpretThreaded(std::size_t functionIndex);
+#endif  // B9_COMPUTED_GOTO
+
+  /// The switch interpreter's loop. Runs a frame that is already on the stack,
+  /// from instructionPointer, until it returns.
+  StackElement run(std::size_t functionIndex,
+                   const Instruction *instructionPointer, StackElement *params,
+                   StackElement *locals);
+
+  /// Where new ShadowFrames link, or nullptr when not profiling, so frames
+  /// aren't published or stepped at all.
+  std::atomic<const ShadowFrame *> *shadowFrameTop() {
+    return cfg_->profile ? &shadowTop_ : nullptr;
+  }
+
+  /// In trace mode, called when an interpreted loop is closed, instead of
+  /// jumping to the loop header. Runs the loop's compiled trace if it has one,
+  /// or records a trace if the loop has just become hot. Returns the
+  /// instruction the frame continues at.
+  const Instruction *doLoop(std::size_t functionIndex, std::size_t header,
+                            StackElement *params, StackElement *locals);
+
+  /// Run one iteration of the loop at header, recording the path it takes,
+  /// and hand the trace to the compiler. Stops at the first instruction that
+  /// can't be traced, without running it. Returns the instruction the frame
+  /// continues at.
+  const Instruction *recordTrace(std::size_t functionIndex, std::size_t header,
+                                 StackElement *params, StackElement *locals);
+
+  /// Compare two int48s, or two strings. Throws if the operands are not of
+  /// the same type.
+  template <typename Compare>
+  bool compare(StackElement left, StackElement right, Compare predicate);
+
   void doFunctionCall(Immediate value);
 
   /// A helper for interpreter-to-jit transitions.
-  Om::Value callJitFunction(JitFunction jitFunction, std::size_t argCount);
+  Om::Value callJitFunction(std::size_t functionIndex, JitFunction jitFunction,
+                            std::size_t argCount);
 
   void doFunctionReturn(StackElement returnVal);
 
@@ -92,18 +169,24 @@ class ExecutionContext {
 
   void doStrPushConstant(Immediate value);
 
-  void doNewObject();
-
   void doPushFromObject(Om::Id slotId);
 
   void doPopIntoObject(Om::Id slotId);
 
-  void doCallIndirect();
+  // Superinstructions
 
-  void doSystemCollect();
+  void doIntAddLocalLocal(StackElement *locals, Immediate left,
+                          Immediate right);
+
+  void doIntSubParamConstant(StackElement *params, Immediate offset,
+                             Immediate constant);
+
+  Immediate doJmpEqZero(Immediate delta);
 
   Om::RunContext omContext_;
   OperandStack stack_;
+  CallStack callStack_;
+  std::atomic<const ShadowFrame *> shadowTop_{nullptr};
   const Config *cfg_;
   VirtualMachine *virtualMachine_;
   Instruction *programCounter_ = 0;
@@ -0,0 +1,137 @@
+#if !defined(B9_OPSTATS_HPP_)
+#define B9_OPSTATS_HPP_
+
+#include <b9/Module.hpp>
+#include <b9/instructions.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace b9 {
+
+/// Execution counts and cycles for the bytecodes the switch interpreter runs:
+/// per opcode, per pair of consecutive opcodes in a frame, and per
+/// instruction. Only gathered in builds with B9_OPSTATS, and only when
+/// Config::opStats is set. Without B9_OPSTATS the interpreter has no hooks.
+class OpStats {
+ public:
+  static constexpr std::size_t OPCODES = 256;
+
+  /// The CPU's timestamp counter, or a steady clock where there isn't one.
+  static std::uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+  }
+
+  /// Counts the instructions one interpreted frame runs. An instruction is
+  /// charged the cycles until the frame's next instruction starts, so a call
+  /// includes its callee. Does nothing if stats is nullptr.
+  class Frame {
+   public:
+    Frame(OpStats *stats, std::size_t functionIndex)
+        : stats_(stats), functionIndex_(functionIndex) {}
+
+    ~Frame() {
+      if (stats_ && previous_ != NONE) {
+        stats_->cycles_[previous_] += readCycles() - start_;
+      }
+    }
+
+    /// The instruction at bytecodeIndex is about to run.
+    void step(std::size_t bytecodeIndex, OpCode op) {
+      if (!stats_) return;
+      std::uint64_t now = readCycles();
+      std::size_t current = static_cast<RawOpCode>(op);
+      if (previous_ != NONE) {
+        stats_->cycles_[previous_] += now - start_;
+        stats_->pairs_[previous_ * OPCODES + current]++;
+      }
+      stats_->counts_[current]++;
+      stats_->countSite(functionIndex_, bytecodeIndex);
+      previous_ = current;
+      start_ = now;
+    }
+
+   private:
+    static constexpr std::size_t NONE = OPCODES;
+
+    OpStats *stats_;
+    std::size_t functionIndex_;
+    std::size_t previous_ = NONE;
+    std::uint64_t start_ = 0;
+  };
+
+  OpStats();
+
+  std::uint64_t count(OpCode op) const {
+    return counts_[static_cast<RawOpCode>(op)];
+  }
+
+  std::uint64_t cycles(OpCode op) const {
+    return cycles_[static_cast<RawOpCode>(op)];
+  }
+
+  std::uint64_t pairCount(OpCode first, OpCode second) const {
+    return pairs_[static_cast<RawOpCode>(first) * OPCODES +
+                  static_cast<RawOpCode>(second)];
+  }
+
+  std::uint64_t siteCount(std::size_t functionIndex,
+                          std::size_t bytecodeIndex) const;
+
+  /// Print the opcodes, pairs and hottest instructions as tables, most run
+  /// first.
+  void print(std::ostream &out, const Module &module) const;
+
+  /// Print every nonzero count as JSON, most run first.
+  void printJson(std::ostream &out, const Module &module) const;
+
+ private:
+  struct Pair {
+    OpCode first;
+    OpCode second;
+    std::uint64_t count;
+  };
+
+  struct Site {
+    std::size_t functionIndex;
+    std::size_t bytecodeIndex;
+    std::uint64_t count;
+  };
+
+  void countSite(std::size_t functionIndex, std::size_t bytecodeIndex) {
+    if (functionIndex >= sites_.size()) {
+      sites_.resize(functionIndex + 1);
+    }
+    auto &function = sites_[functionIndex];
+    if (bytecodeIndex >= function.size()) {
+      function.resize(bytecodeIndex + 1);
+    }
+    function[bytecodeIndex]++;
+  }
+
+  std::vector<OpCode> sortedOpCodes() const;
+
+  std::vector<Pair> sortedPairs() const;
+
+  std::vector<Site> sortedSites() const;
+
+  std::vector<std::uint64_t> counts_;
+  std::vector<std::uint64_t> cycles_;
+  std::vector<std::uint64_t> pairs_;
+  std::vector<std::vector<std::uint64_t>> sites_;
+};
+
+}  // namespace b9
+
+#endif  // B9_OPSTATS_HPP_
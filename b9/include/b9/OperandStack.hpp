@@ -13,13 +13,21 @@ namespace Om = OMR::Om;
 
 using StackElement = Om::Value;
 
+/// The operand stack. The stack is mapped with a PROT_NONE guard page just past
+/// its end, so push and pushn don't have to check for overflow. Touching the
+/// guard page is caught by a SIGSEGV handler, which reports the overflow and
+/// exits. Pages are only committed as the stack grows into them, so very large
+/// stacks are cheap.
 class OperandStack {
  public:
-  static constexpr std::size_t SIZE = 1000;
+  /// Map a stack of size elements. The size is rounded up to a whole page.
+  explicit OperandStack(std::size_t size);
 
-  OperandStack() noexcept : top_(&stack_[0]) {
-    memset(stack_, 0, sizeof(stack_));
-  }
+  ~OperandStack() noexcept;
+
+  OperandStack(const OperandStack &) = delete;
+
+  OperandStack &operator=(const OperandStack &) = delete;
 
   void reset() { top_ = &stack_[0]; }
 
@@ -60,6 +68,9 @@ class OperandStack {
 
   void restore(StackElement *top) { top_ = top; }
 
+  /// The number of elements the stack can hold.
+  std::size_t capacity() const { return capacity_; }
+
   template <typename VisitorT>
   void visit(VisitorT &visitor) {
     for (StackElement &element : *this) {
@@ -73,7 +84,10 @@ class OperandStack {
   friend class OperandStackOffset;
 
   StackElement *top_;
-  StackElement stack_[SIZE];
+  StackElement *stack_;
+  std::size_t capacity_;
+  void *mapping_;
+  std::size_t mappingSize_;
 };
 
 inline std::ostream &printStack(std::ostream &out, const OperandStack &stack) {
@@ -0,0 +1,159 @@
+#if !defined(B9_PROFILER_HPP_)
+#define B9_PROFILER_HPP_
+
+#include <b9/instructions.hpp>
+
+#include <pthread.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace b9 {
+
+class VirtualMachine;
+
+/// An activation the sampling profiler can see. Interpreted frames, and calls
+/// from the interpreter into compiled code, link a ShadowFrame into the
+/// ExecutionContext's chain for as long as they run. The chain is only ever
+/// written by its own thread, so a signal handler on that thread can walk it.
+class ShadowFrame {
+ public:
+  /// Link a frame onto top. start is the function's first instruction, or
+  /// nullptr if the frame runs compiled code. If top is nullptr, the frame is
+  /// never linked, and costs nothing more than its construction.
+  ShadowFrame(std::atomic<const ShadowFrame *> *top, std::size_t functionIndex,
+              const Instruction *start)
+      : top_(top),
+        caller_(top ? top->load(std::memory_order_relaxed) : nullptr),
+        functionIndex_(functionIndex),
+        start_(start),
+        instruction_(start) {
+    if (top_) {
+      // The frame must be complete before a handler can find it.
+      std::atomic_signal_fence(std::memory_order_release);
+      top_->store(this, std::memory_order_relaxed);
+    }
+  }
+
+  ~ShadowFrame() {
+    if (top_) top_->store(caller_, std::memory_order_relaxed);
+  }
+
+  ShadowFrame(const ShadowFrame &) = delete;
+  ShadowFrame &operator=(const ShadowFrame &) = delete;
+
+  /// Whether the frame is linked, and so needs to step.
+  bool linked() const { return top_ != nullptr; }
+
+  /// The interpreter is about to run instruction.
+  void step(const Instruction *instruction) {
+    instruction_.store(instruction, std::memory_order_relaxed);
+  }
+
+  const ShadowFrame *caller() const { return caller_; }
+
+  std::size_t functionIndex() const { return functionIndex_; }
+
+  bool compiled() const { return start_ == nullptr; }
+
+  /// The index of the instruction being run. Meaningless if compiled.
+  std::size_t bytecodeIndex() const {
+    return instruction_.load(std::memory_order_relaxed) - start_;
+  }
+
+ private:
+  std::atomic<const ShadowFrame *> *top_;
+  const ShadowFrame *caller_;
+  std::size_t functionIndex_;
+  const Instruction *start_;
+  std::atomic<const Instruction *> instruction_;
+};
+
+/// A timer driven sampling profiler. While running, SIGPROF interrupts the
+/// process every interval microseconds of CPU time, and the handler copies
+/// the interrupted thread's shadow frames, and the machine pc, into a buffer
+/// allocated up front. Nothing is named or aggregated until the profile is
+/// written, so the handler is async-signal-safe.
+///
+/// Only one Profiler runs at a time in a process.
+class Profiler {
+ public:
+  /// The default sampling interval, in microseconds of CPU time.
+  static constexpr std::size_t DEFAULT_INTERVAL = 1000;
+
+  /// Deeper stacks are cut off at their outermost frames.
+  static constexpr std::size_t MAX_DEPTH = 128;
+
+  /// The size of the sample buffer, in words. Samples that don't fit are
+  /// dropped.
+  static constexpr std::size_t BUFFER_SIZE = std::size_t(1) << 21;
+
+  explicit Profiler(std::size_t interval = DEFAULT_INTERVAL);
+
+  ~Profiler() noexcept { stop(); }
+
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  /// Samples the shadow frames on top for as long as it lives.
+  class Session {
+   public:
+    Session(Profiler *profiler, const std::atomic<const ShadowFrame *> &top)
+        : profiler_(profiler) {
+      if (profiler_) profiler_->start(top);
+    }
+
+    ~Session() noexcept {
+      if (profiler_) profiler_->stop();
+    }
+
+   private:
+    Profiler *profiler_;
+  };
+
+  /// Start sampling the calling thread's shadow frames, which start at top.
+  void start(const std::atomic<const ShadowFrame *> &top);
+
+  /// Stop sampling. Does nothing unless started.
+  void stop() noexcept;
+
+  /// Take one sample. Called by the SIGPROF handler, with the pc it
+  /// interrupted.
+  void sample(std::uintptr_t pc);
+
+  /// The number of samples taken of the profiled thread.
+  std::size_t samples() const { return samples_; }
+
+  /// The number of samples that didn't fit in the buffer.
+  std::size_t dropped() const { return dropped_; }
+
+  /// Write the samples as folded stacks, one line per distinct stack, outermost
+  /// frame first, followed by its count. Interpreted frames are named after
+  /// their function, and an interpreted leaf gets a frame for its current
+  /// instruction. Calls into compiled code are marked [compiled], and a pc in
+  /// a compiled body gets a leaf frame naming the body. Samples taken on other
+  /// threads, such as the background compiler, are written as [other thread].
+  void write(std::ostream &out, VirtualMachine &virtualMachine) const;
+
+ private:
+  /// Words before the frames of each sample: depth, truncated, pc.
+  static constexpr std::size_t HEADER_SIZE = 3;
+
+  /// The bytecode index recorded for a compiled frame.
+  static constexpr std::uintptr_t COMPILED = UINTPTR_MAX;
+
+  std::size_t interval_;
+  const std::atomic<const ShadowFrame *> *top_ = nullptr;
+  pthread_t thread_;
+  std::vector<std::uintptr_t> buffer_;
+  std::size_t used_ = 0;
+  std::atomic<std::size_t> samples_{0};
+  std::atomic<std::size_t> dropped_{0};
+  std::atomic<std::size_t> otherThreads_{0};
+};
+
+}  // namespace b9
+
+#endif  // B9_PROFILER_HPP_
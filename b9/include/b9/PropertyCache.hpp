@@ -0,0 +1,87 @@
+#if !defined(B9_PROPERTYCACHE_HPP_)
+#define B9_PROPERTYCACHE_HPP_
+
+#include <OMR/Om/ObjectOperations.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace b9 {
+
+namespace Om = OMR::Om;
+
+/// An inline cache for a single PUSH_FROM_OBJECT or POP_INTO_OBJECT. Each entry
+/// maps an object's shape to the descriptor of the accessed slot. For a store
+/// that adds the slot, the entry also records the shape the object transitions
+/// to. The cache holds up to SIZE shapes. Once full, the site is megamorphic
+/// and misses are no longer cached.
+///
+/// Shapes are compared by address, and aren't traced by the GC, so every cache
+/// is flushed when the GC runs.
+///
+/// Compiled code checks the primary (first) entry inline, loading the shape
+/// and offset straight out of the cache, and calls into the runtime on a miss.
+class PropertyCache {
+ public:
+  static constexpr std::size_t SIZE = 4;
+
+  struct Entry {
+    const void *shape;
+    Om::Shape *transition;  //< Null unless the store adds the slot.
+    std::size_t offset;      //< The slot's offset into the object.
+    Om::SlotDescriptor descriptor;
+  };
+
+  explicit PropertyCache(Om::Id slotId) : slotId_(slotId) {}
+
+  Om::Id slotId() const { return slotId_; }
+
+  /// Find the entry for a shape. Counts a hit or a miss.
+  const Entry *lookup(const void *shape) {
+    for (std::size_t i = 0; i < count_; i++) {
+      if (entries_[i].shape == shape) {
+        hits_++;
+        return &entries_[i];
+      }
+    }
+    misses_++;
+    return nullptr;
+  }
+
+  /// Cache a slot descriptor, if there is room.
+  void insert(const void *shape, Om::Shape *transition,
+              const Om::SlotDescriptor &descriptor) {
+    if (count_ < SIZE) {
+      entries_[count_++] = {shape, transition, descriptor.offset(), descriptor};
+    }
+  }
+
+  /// Empty the cache. Shapes are cleared too, since compiled code reads the
+  /// primary entry without checking the size.
+  void flush() {
+    for (auto &entry : entries_) {
+      entry.shape = nullptr;
+    }
+    count_ = 0;
+  }
+
+  /// The entry checked inline by compiled code. Only valid if shape is set.
+  const Entry &primary() const { return entries_[0]; }
+
+  std::size_t size() const { return count_; }
+
+  std::uint64_t hits() const { return hits_; }
+
+  std::uint64_t misses() const { return misses_; }
+
+ private:
+  Om::Id slotId_;
+  std::size_t count_ = 0;
+  Entry entries_[SIZE] = {};
+  std::uint64_t hits_ = 0;
+  std::uint64_t misses_ = 0;
+};
+
+}  // namespace b9
+
+#endif  // B9_PROPERTYCACHE_HPP_
@@ -0,0 +1,30 @@
+#if !defined(B9_SUPERINSTRUCTIONS_HPP_)
+#define B9_SUPERINSTRUCTIONS_HPP_
+
+#include <b9/Module.hpp>
+#include <b9/instructions.hpp>
+
+#include <cstddef>
+#include <memory>
+
+namespace b9 {
+
+/// Rewrite the common instruction sequences in a function into
+/// superinstructions. Answers the number of sequences fused. The sequences
+/// were picked from the opcode pairs the interpreter runs most, as printed by
+/// b9run -opstats.
+std::size_t fuseSuperinstructions(FunctionDef &function);
+
+/// Answer a copy of the module, with superinstructions fused into every
+/// function.
+std::shared_ptr<Module> fuseSuperinstructions(const Module &module);
+
+/// The first opcode of the sequence a superinstruction fuses, or op itself.
+/// Since the rest of a fused sequence is left in place, code that walks a
+/// function an instruction at a time, like the trace recorder, can run a
+/// superinstruction as its first instruction, and carry on into the rest.
+OpCode unfused(OpCode op);
+
+}  // namespace b9
+
+#endif  // B9_SUPERINSTRUCTIONS_HPP_
@@ -0,0 +1,54 @@
+#if !defined(B9_THREADEDCODE_HPP_)
+#define B9_THREADEDCODE_HPP_
+
+#include <b9/Module.hpp>
+#include <b9/PropertyCache.hpp>
+#include <b9/instructions.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace b9 {
+
+/// A pre-decoded instruction, as executed by the threaded interpreter. The
+/// handler is the address of the interpreter's handler for the opcode, and the
+/// immediate is already sign extended. Jumps carry a pointer to their
+/// destination, instead of a relative offset. Object accesses carry a pointer
+/// to their inline cache, which holds the slot id.
+struct ThreadedInstruction {
+  const void *handler;
+  union {
+    std::int64_t immediate;
+    const ThreadedInstruction *target;
+    PropertyCache *cache;
+  };
+};
+
+/// The pre-decoded body of a FunctionDef. Empty until the function has been
+/// translated. Instructions point into the ThreadedFunction's own storage, so
+/// a ThreadedFunction may be moved, but never copied.
+struct ThreadedFunction {
+  std::vector<ThreadedInstruction> code;
+  std::vector<PropertyCache> caches;
+
+  bool empty() const { return code.empty(); }
+};
+
+/// Thrown when a function's bytecode can't be translated to threaded code.
+struct TranslationException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// Translate a function's instructions to threaded code. The handlers table is
+/// indexed by raw opcode. Opcodes outside of the table are translated to
+/// unknownHandler.
+ThreadedFunction translate(const FunctionDef &function,
+                           const void *const handlers[],
+                           std::size_t handlerCount,
+                           const void *unknownHandler);
+
+}  // namespace b9
+
+#endif  // B9_THREADEDCODE_HPP_
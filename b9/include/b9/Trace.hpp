@@ -0,0 +1,30 @@
+#if !defined(B9_TRACE_HPP_)
+#define B9_TRACE_HPP_
+
+#include <cstddef>
+#include <vector>
+
+namespace b9 {
+
+/// The longest trace that will be recorded, in instructions.
+constexpr std::size_t MAX_TRACE_LENGTH = 1000;
+
+/// One instruction executed while recording a trace.
+struct TraceStep {
+  std::size_t bytecodeIndex;
+  bool taken;  //< For a conditional jump, whether it jumped
+};
+
+/// The path one iteration of a hot loop actually took through its function,
+/// from the loop header back around to it. Every value the iteration loaded
+/// from a local or param was observed to be an int48, and the iteration left
+/// the operand stack as deep as it found it.
+struct Trace {
+  std::size_t functionIndex;
+  std::size_t header;
+  std::vector<TraceStep> steps;
+};
+
+}  // namespace b9
+
+#endif  // B9_TRACE_HPP_
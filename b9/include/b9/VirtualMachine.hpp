@@ -1,8 +1,14 @@
 #ifndef B9_VIRTUALMACHINE_HPP_
 #define B9_VIRTUALMACHINE_HPP_
 
+#include <b9/CallProfile.hpp>
+#include <b9/CompileQueue.hpp>
 #include <b9/Module.hpp>
+#include <b9/OpStats.hpp>
 #include <b9/OperandStack.hpp>
+#include <b9/Profiler.hpp>
+#include <b9/ThreadedCode.hpp>
+#include <b9/Trace.hpp>
 #include <b9/compiler/Compiler.hpp>
 #include <b9/instructions.hpp>
 
@@ -14,9 +20,11 @@
 #include <OMR/Om/ShapeOperations.hpp>
 #include <OMR/Om/Value.hpp>
 
+#include <atomic>
 #include <cstring>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -36,22 +44,52 @@ class ExecutionContext;
 class VirtualMachine;
 
 struct Config {
-  std::size_t maxInlineDepth = 0;  //< The JIT's max inline depth
-  bool jit = false;                //< Enable the JIT
-  bool directCall = false;         //< Enable direct JIT to JIT calls
-  bool passParam = false;          //< Pass arguments in CPU registers
-  bool lazyVmState = false;        //< Simulate the VM state
-  bool debug = false;              //< Enable debug code
-  bool verbose = false;            //< Enable verbose printing and tracing
+  std::size_t maxInlineDepth = 0;        //< The JIT's max inline depth
+  std::size_t maxCallDepth = 100000;     //< Max depth of threaded calls
+  std::size_t stackSize = 1000;          //< Operand stack size, in elements
+  std::uint64_t tierUpThreshold = 1000;  //< Calls and loops before compiling
+  std::uint64_t hotThreshold = 10000;    //< Warm calls and loops to recompile
+  bool jit = false;                      //< Enable the JIT
+  bool tiered = false;                   //< Compile functions once they are hot
+  bool backgroundCompile = false;        //< Tier up on a background thread
+  bool multiTier = false;                //< Recompile hot functions, inlining
+  bool traceJit = false;                 //< Compile hot loops as traces
+  bool perfMap = false;                  //< Name jitted code for Linux perf
+  bool opStats = false;                  //< Count interpreted bytecodes
+  bool profile = false;                  //< Sample stacks while running
+  bool callProfile = false;              //< Count and time every call
+  bool directCall = false;               //< Enable direct JIT to JIT calls
+  bool passParam = false;                //< Pass arguments in CPU registers
+  bool lazyVmState = false;              //< Simulate the VM state
+  bool speculate = false;                //< Speculate on types in the JIT
+  bool threaded = false;                 //< Use the threaded interpreter
+  bool superinstructions = false;        //< Fuse common instruction sequences
+  bool debug = false;                    //< Enable debug code
+  bool verbose = false;                  //< Enable verbose printing and tracing
 };
 
 inline std::ostream &operator<<(std::ostream &out, const Config &cfg) {
   out << std::boolalpha;
   out << "Mode:         " << (cfg.jit ? "JIT" : "Interpreter") << std::endl
       << "Inline depth: " << cfg.maxInlineDepth << std::endl
+      << "Call depth:   " << cfg.maxCallDepth << std::endl
+      << "Stack size:   " << cfg.stackSize << std::endl
+      << "tiered:       " << cfg.tiered << std::endl
+      << "background:   " << cfg.backgroundCompile << std::endl
+      << "Threshold:    " << cfg.tierUpThreshold << std::endl
+      << "multitier:    " << cfg.multiTier << std::endl
+      << "Recompile at: " << cfg.hotThreshold << std::endl
+      << "trace:        " << cfg.traceJit << std::endl
+      << "perfmap:      " << cfg.perfMap << std::endl
+      << "opstats:      " << cfg.opStats << std::endl
+      << "profile:      " << cfg.profile << std::endl
+      << "callprofile:  " << cfg.callProfile << std::endl
       << "directcall:   " << cfg.directCall << std::endl
       << "passparam:    " << cfg.passParam << std::endl
       << "lazyvmstate:  " << cfg.lazyVmState << std::endl
+      << "speculate:    " << cfg.speculate << std::endl
+      << "threaded:     " << cfg.threaded << std::endl
+      << "superinstrs:  " << cfg.superinstructions << std::endl
       << "debug:        " << cfg.debug;
   out << std::noboolalpha;
   return out;
@@ -63,6 +101,30 @@ struct BadFunctionCallException : public std::runtime_error {
 
 extern "C" typedef Om::RawValue (*JitFunction)(void *executionContext, ...);
 
+/// Profiling counters for a single function. Used to decide when a function
+/// is hot enough to compile, and, with multiple tiers, to recompile. The warm
+/// counters are updated in place by warm compiled code.
+struct FunctionProfile {
+  std::uint64_t invocations = 0;      //< Interpreted calls
+  std::uint64_t backEdges = 0;        //< Backward jumps taken when interpreted
+  std::uint64_t warmInvocations = 0;  //< Calls of warm compiled code
+  std::uint64_t warmBackEdges = 0;    //< Loop headers reached in warm code
+  std::uint64_t deoptimizations = 0;  //< Failed speculations in compiled code
+  bool compiled = false;              //< Compilation has been attempted
+  bool optimized = false;             //< Hot recompilation has been attempted
+
+  std::uint64_t count() const { return invocations + backEdges; }
+
+  std::uint64_t warmCount() const { return warmInvocations + warmBackEdges; }
+};
+
+/// A loop in an interpreted function, in trace mode.
+struct LoopProfile {
+  std::uint64_t iterations = 0;   //< Times the loop was closed, untraced
+  bool recorded = false;          //< A trace has been recorded
+  TraceFunction trace = nullptr;  //< The compiled trace, if any
+};
+
 class VirtualMachine {
  public:
   VirtualMachine(Om::ProcessRuntime &runtime, const Config &cfg);
@@ -82,12 +144,104 @@ class VirtualMachine {
 
   PrimitiveFunction *getPrimitive(std::size_t index);
 
+  /// The compiled code for a function, or nullptr. Safe to call while a
+  /// background compile is installing code.
   JitFunction getJitAddress(std::size_t functionIndex);
 
   void setJitAddress(std::size_t functionIndex, JitFunction value);
 
+  /// The entry in the linkage table for a function. Compiled code loads it to
+  /// make late-bound calls. It holds the function's compiled code, or nullptr.
+  const std::atomic<JitFunction> *getLinkage(std::size_t functionIndex) const {
+    return &compiledFunctions_[functionIndex];
+  }
+
+  /// The transition into pass-param functions taking nparams, compiled on
+  /// first use.
+  JitThunk getJitThunk(std::size_t nparams);
+
+  /// Wait for all background compiles to be installed. Does nothing unless
+  /// compiling in the background.
+  void waitForCompiles();
+
+  /// Print the background compile queue's counters.
+  void printCompileStatistics(std::ostream &out) const;
+
   std::size_t getFunctionCount();
 
+  /// The threaded code for a function. Empty until the threaded interpreter
+  /// first runs the function.
+  ThreadedFunction &getThreadedCode(std::size_t functionIndex);
+
+  /// The inline cache for the object access at bytecodeIndex of a function in
+  /// compiled code. Every body the site is compiled into, including inlined
+  /// copies and recompiles, shares one cache, which is made on first use and
+  /// kept until the next load.
+  PropertyCache &getJitPropertyCache(std::size_t functionIndex,
+                                     std::size_t bytecodeIndex, Om::Id slotId);
+
+  /// Empty every inline cache, in both threaded and compiled code.
+  void flushPropertyCaches();
+
+  /// Print the hit and miss counts of the inline caches.
+  void printPropertyCacheStatistics(std::ostream &out) const;
+
+  /// The bytecode counts of the module, or nullptr unless counting. Counts
+  /// are only taken in builds with B9_OPSTATS.
+  OpStats *opStats() { return opStats_.get(); }
+
+  /// The sampling profiler, or nullptr unless profiling. Each run is sampled
+  /// from start to finish.
+  Profiler *profiler() { return profiler_.get(); }
+
+  /// The call counts and times of the module, or nullptr unless profiling
+  /// calls.
+  CallProfile *callProfile() { return callProfile_.get(); }
+
+  /// Count an interpreted call to a function. In tiered mode, compiles the
+  /// function once it crosses the tier-up threshold. Returns the function's
+  /// compiled code, or nullptr if it isn't compiled.
+  JitFunction countInvocation(std::size_t functionIndex);
+
+  /// Count a backward jump to the loop header at target, taken in an
+  /// interpreted function. In tiered mode, once the function is hot, it is
+  /// compiled for the next call, and an OSR entry at the loop header is
+  /// returned, so the running frame can move to compiled code. Returns nullptr
+  /// if the frame should stay in the interpreter.
+  OsrFunction countBackEdge(std::size_t functionIndex, std::size_t target);
+
+  /// Count an interpreted iteration of the loop at header, in trace mode.
+  /// Returns the loop's compiled trace, if it has one. Otherwise, sets record
+  /// once the loop becomes hot, so the interpreter records a trace.
+  TraceFunction countLoop(std::size_t functionIndex, std::size_t header,
+                          bool &record);
+
+  /// The compiled trace of the loop at header, or nullptr.
+  TraceFunction getTrace(std::size_t functionIndex, std::size_t header) const;
+
+  /// Compile a recorded trace, and install it for its loop. Failures leave
+  /// the loop interpreted.
+  void compileTrace(const Trace &trace);
+
+  /// Note that a speculation failed in a function's compiled code. The first
+  /// time, the function is recompiled without speculating, and any OSR
+  /// entries are dropped. Compiled callers that call the old code directly
+  /// still work, they just deoptimize every time.
+  void deoptimized(std::size_t functionIndex);
+
+  /// Recompile a hot function at the hot tier, replacing its warm code. Warm
+  /// code calls this once its counters cross the hot threshold. Frames already
+  /// running the warm code finish in it.
+  void recompileHot(std::size_t functionIndex);
+
+  const FunctionProfile &getProfile(std::size_t functionIndex) const {
+    return profiles_[functionIndex];
+  }
+
+  FunctionProfile &getProfile(std::size_t functionIndex) {
+    return profiles_[functionIndex];
+  }
+
   JitFunction generateCode(const std::size_t functionIndex);
 
   void generateAllCode();
@@ -108,11 +262,46 @@ class VirtualMachine {
   static constexpr PrimitiveFunction *const primitives_[] = {
       b9_prim_print_string, b9_prim_print_number, b9_prim_print_stack};
 
+  /// Compile a function that has crossed the tier-up threshold. Compilation
+  /// is only attempted once, failures leave the function interpreted. When
+  /// compiling in the background, returns nullptr, and the function keeps
+  /// running in the interpreter until the compiled code is installed.
+  JitFunction tierUp(std::size_t functionIndex);
+
+  /// Compile a function and install the result. The compiler mutex is held
+  /// until the code is installed, so compiles of one function install in the
+  /// order they were made.
+  void compileAndInstall(std::size_t functionIndex);
+
+  /// Compile a function at its next tier, with the compiler mutex held.
+  /// Answers nullptr if the compile fails.
+  JitFunction compile(std::size_t functionIndex);
+
+  /// The tier a function's next compile is at.
+  Tier nextTier(std::size_t functionIndex) const;
+
+  /// The OSR entry into a function at a loop header, compiling it on first
+  /// use. Returns nullptr if it can't be compiled.
+  OsrFunction getOsrEntry(std::size_t functionIndex, std::size_t target);
+
   Config cfg_;
   Om::MemorySystem memoryManager_;
   std::shared_ptr<Compiler> compiler_;
   std::shared_ptr<const Module> module_;
-  std::vector<JitFunction> compiledFunctions_;
+  std::vector<std::atomic<JitFunction>> compiledFunctions_;  //< Linkage table
+  std::vector<FunctionProfile> profiles_;
+  std::vector<JitThunk> thunks_;
+  std::map<std::pair<std::size_t, std::size_t>, OsrFunction> osrEntries_;
+  std::map<std::pair<std::size_t, std::size_t>, LoopProfile> loops_;
+  std::vector<ThreadedFunction> threadedCode_;
+  std::map<std::pair<std::size_t, std::size_t>, PropertyCache>
+      jitPropertyCaches_;
+  mutable std::mutex jitPropertyCachesMutex_;
+  std::mutex compilerMutex_;  //< Held while the compiler is in use
+  std::unique_ptr<CompileQueue> compileQueue_;
+  std::unique_ptr<OpStats> opStats_;
+  std::unique_ptr<Profiler> profiler_;
+  std::unique_ptr<CallProfile> callProfile_;
 };
 
 }  // namespace b9
@@ -129,6 +318,36 @@ Om::RawValue interpret(ExecutionContext *context,
                        const std::size_t functionIndex);
 
 void primitive_call(ExecutionContext *context, Immediate value);
+
+// Slow paths for object operations in compiled code
+
+void new_object(ExecutionContext *context);
+
+Om::RawValue push_from_object(ExecutionContext *context, PropertyCache *cache,
+                              Om::RawValue object);
+
+void pop_into_object(ExecutionContext *context, PropertyCache *cache,
+                     Om::RawValue object, Om::RawValue value);
+
+void call_indirect(ExecutionContext *context);
+
+void system_collect(ExecutionContext *context);
+
+// Speculation support
+
+/// Compare two values in the runtime. Returns nonzero if the jump is taken.
+std::int32_t compare_values(ExecutionContext *context, std::int32_t op,
+                            Om::RawValue left, Om::RawValue right);
+
+/// Continue a compiled frame in the interpreter. See ExecutionContext::resume.
+Om::RawValue deoptimize(ExecutionContext *context, std::size_t functionIndex,
+                        std::size_t bytecodeIndex, Om::Value *stackBase,
+                        Om::Value *operandBase);
+
+// Tiering support
+
+/// Recompile a hot function. See VirtualMachine::recompileHot.
+void recompile_hot(ExecutionContext *context, std::size_t functionIndex);
 }
 
 #endif  // B9_VIRTUALMACHINE_HPP_
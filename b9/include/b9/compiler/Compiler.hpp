@@ -2,6 +2,7 @@
 #define B9_COMPILER_HPP_
 
 #include "b9/compiler/GlobalTypes.hpp"
+#include "b9/compiler/PerfMap.hpp"
 #include "b9/instructions.hpp"
 
 #include <Jit.hpp>
@@ -9,6 +10,11 @@
 
 #include <OMR/Om/Value.hpp>
 
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 namespace b9 {
@@ -20,9 +26,37 @@ class FunctionDef;
 class Stack;
 class VirtualMachine;
 class ExecutionContext;
+struct Trace;
 
 extern "C" typedef Om::RawValue (*JitFunction)(void *executionContext, ...);
 
+/// An on-stack replacement entry. Continues an interpreted frame, given the
+/// frame's locals, at a loop header. The params are just below the locals, and
+/// the operand stack above them, as the interpreter left them.
+extern "C" typedef Om::RawValue (*OsrFunction)(void *executionContext,
+                                               Om::Value *locals);
+
+/// An interpreter-to-jit transition for pass-param functions of one arity.
+/// Calls target, passing the args in registers.
+extern "C" typedef Om::RawValue (*JitThunk)(void *executionContext,
+                                            JitFunction target,
+                                            Om::Value *args);
+
+/// A compiled trace through a loop. Runs the loop in the interpreted frame with
+/// the given params and locals, starting at the loop header, and returns the
+/// index of the instruction where the interpreter continues.
+extern "C" typedef std::size_t (*TraceFunction)(void *executionContext,
+                                                Om::Value *params,
+                                                Om::Value *locals);
+
+/// How much work the JIT puts into a function. Without multiple tiers, every
+/// function is compiled once, at the default tier.
+enum class Tier : std::uint8_t {
+  DEFAULT,  //< Inline as configured
+  WARM,     //< Fast to compile: no inlining, and count calls and loops
+  HOT,      //< Recompiled once warm code is hot: inline deeper
+};
+
 /// Function not found exception.
 struct CompilationException : public std::runtime_error {
   using std::runtime_error::runtime_error;
@@ -31,7 +65,18 @@ struct CompilationException : public std::runtime_error {
 class Compiler {
  public:
   Compiler(VirtualMachine &virtualMachine, const Config &cfg);
-  JitFunction generateCode(const std::size_t functionIndex);
+  JitFunction generateCode(const std::size_t functionIndex,
+                           const Tier tier = Tier::DEFAULT);
+
+  /// Compile an OSR entry into a function, at the instruction index entry.
+  OsrFunction generateOsrCode(const std::size_t functionIndex,
+                              const std::size_t entry);
+
+  /// Compile a recorded trace through a loop.
+  TraceFunction generateTraceCode(const Trace &trace);
+
+  /// Compile a transition into pass-param functions taking nparams.
+  JitThunk generateThunk(const std::size_t nparams);
 
   const GlobalTypes &globalTypes() const { return globalTypes_; }
 
@@ -39,11 +84,22 @@ class Compiler {
 
   const TR::TypeDictionary &typeDictionary() const { return typeDictionary_; }
 
+  /// The name of the compiled body holding pc, or an empty string if pc isn't
+  /// in compiled code. Bodies are sized as in the perf map.
+  std::string findCode(std::uintptr_t pc) const;
+
  private:
+  /// Record the name of a compiled body, and add it to the perf map, if there
+  /// is one.
+  void nameCode(const void *start, const std::string &name);
+
   TR::TypeDictionary typeDictionary_;
   const GlobalTypes globalTypes_;
   VirtualMachine &virtualMachine_;
   const Config &cfg_;
+  std::unique_ptr<PerfMap> perfMap_;
+  std::map<std::uintptr_t, std::string> bodies_;
+  mutable std::mutex bodiesMutex_;
 };
 
 }  // namespace b9
@@ -15,6 +15,7 @@ class GlobalTypes {
   TR::IlType *int64Ptr;
   TR::IlType *int32Ptr;
   TR::IlType *int16Ptr;
+  TR::IlType *int8Ptr;
 
   TR::IlType *stackElement;
   TR::IlType *stackElementPtr;
@@ -25,6 +26,9 @@ class GlobalTypes {
   TR::IlType *operandStackPtr;
   TR::IlType *executionContext;
   TR::IlType *executionContextPtr;
+
+  TR::IlType *object;
+  TR::IlType *objectPtr;
 };
 
 }  // namespace b9
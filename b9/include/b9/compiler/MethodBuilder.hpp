@@ -5,6 +5,7 @@
 #include "b9/compiler/Compiler.hpp"
 #include "b9/compiler/GlobalTypes.hpp"
 #include "b9/compiler/State.hpp"
+#include "b9/compiler/TypeInference.hpp"
 #include "b9/instructions.hpp"
 
 #include <Jit.hpp>
@@ -12,7 +13,10 @@
 #include <ilgen/MethodBuilder.hpp>
 #include <ilgen/TypeDictionary.hpp>
 
+#include <deque>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace b9 {
@@ -21,22 +25,53 @@ class VirtualMachine;
 
 class MethodBuilder : public TR::MethodBuilder {
  public:
-  MethodBuilder(VirtualMachine &virtualMachine,
-                const std::size_t functionIndex);
+  MethodBuilder(VirtualMachine &virtualMachine, const std::size_t functionIndex,
+                const Tier tier = Tier::DEFAULT);
+
+  /// Build an OSR entry into a function. The method takes the interpreted
+  /// frame's locals, and starts at the instruction index osrEntry.
+  MethodBuilder(VirtualMachine &virtualMachine, const std::size_t functionIndex,
+                const std::size_t osrEntry);
 
   virtual bool buildIL();
 
  private:
+  /// The body of a function being compiled: either the method itself, or a
+  /// function inlined into it. Every body gets its own range of bytecode
+  /// builder indices, starting at base, so the bodies share one worklist.
+  /// Inlined params and locals live in fresh IL locals.
+  struct InlineFrame {
+    std::size_t functionIndex;
+    std::size_t base;
+    std::size_t depth;  //< 0 for the method itself
+    const InlineFrame *caller;
+    TR::BytecodeBuilder *continuation;  //< Where returns go, if inlined
+    std::vector<TR::BytecodeBuilder *> builders;
+    std::vector<std::string> params;  //< Empty unless inlined
+    std::vector<std::string> locals;
+    std::unique_ptr<TypeInference> types;
+  };
+
+  /// The largest function, in instructions, that will be inlined.
+  static constexpr std::size_t MAX_INLINE_SIZE = 32;
+
+  /// The least inline depth of hot code.
+  static constexpr std::size_t HOT_INLINE_DEPTH = 4;
+
+  MethodBuilder(VirtualMachine &virtualMachine, const std::size_t functionIndex,
+                const std::size_t osrEntry, const Tier tier);
+
   void defineFunctions();
 
   void defineParams();
 
   void defineLocals();
 
-  /// For a single bytecode, generate the
+  /// For a single bytecode, generate the IL. Called once per bytecode, so it
+  /// must only do constant work outside the handler itself.
   bool generateILForBytecode(
       const FunctionDef *function,
-      std::vector<TR::BytecodeBuilder *> bytecodeBuilderTable,
+      const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
       std::size_t instructionIndex,
       TR::BytecodeBuilder *jumpToBuilderForInlinedReturn);
 
@@ -45,6 +80,9 @@ class MethodBuilder : public TR::MethodBuilder {
       TR::BytecodeBuilder *currentBuilder = 0,
       TR::BytecodeBuilder *jumpToBuilderForInlinedReturn = 0);
 
+  /// Decide whether a call from the current body should be inlined.
+  bool shouldInline(std::size_t target);
+
   // Helpers
 
   void pushValue(TR::BytecodeBuilder *builder, TR::IlValue *value);
@@ -59,8 +97,16 @@ class MethodBuilder : public TR::MethodBuilder {
 
   TR::IlValue *popUint48(TR::BytecodeBuilder *builder);
 
+  TR::IlValue *boxInt48(TR::IlBuilder *b, TR::IlValue *value);
+
+  /// Unbox an int48, reusing the raw value if the box was made here.
+  TR::IlValue *unboxInt48(TR::IlBuilder *b, TR::IlValue *value);
+
   void drop(TR::BytecodeBuilder *builder, std::size_t n = 1);
 
+  /// Copy the interpreted frame's locals into an OSR method.
+  void loadOsrLocals();
+
   TR::IlValue *loadLocal(TR::IlBuilder *b, std::size_t index);
 
   void storeLocal(TR::IlBuilder *b, std::size_t index, TR::IlValue *value);
@@ -75,6 +121,45 @@ class MethodBuilder : public TR::MethodBuilder {
 
   void passParamCall(TR::BytecodeBuilder *builder, std::size_t target);
 
+  /// A direct call to a function that wasn't compiled when this one was.
+  void lateBoundCall(TR::BytecodeBuilder *builder, std::size_t target);
+
+  /// Call a runtime function that takes only the execution context, and works
+  /// on the operand stack.
+  void runtimeCall(TR::BytecodeBuilder *builder, const char *name);
+
+  /// Load the shape of an object value into the objectShape local. Values
+  /// that aren't objects get an address that never matches a cached shape.
+  void loadShape(TR::BytecodeBuilder *builder, TR::IlValue *value,
+                 const PropertyCache &cache);
+
+  /// True if the body being generated may speculate. Speculation is off once
+  /// the function has deoptimized, and inlined bodies never speculate.
+  bool canSpeculate() const;
+
+  /// Deoptimize at bytecodeIndex unless every operand is an int48. The
+  /// operands have been popped, and are in stack order.
+  void guardInt48(TR::BytecodeBuilder *builder, std::size_t bytecodeIndex,
+                  const std::vector<TR::IlValue *> &operands);
+
+  /// In b, leave compiled code and continue in the interpreter, just before
+  /// the instruction at bytecodeIndex. The operands the instruction popped
+  /// are pushed back.
+  void deoptimize(TR::BytecodeBuilder *builder, TR::IlBuilder *b,
+                  std::size_t bytecodeIndex,
+                  const std::vector<TR::IlValue *> &operands);
+
+  /// Push a value onto the operand stack in memory, bypassing the state.
+  void pushToStack(TR::IlBuilder *b, TR::IlValue *value);
+
+  /// True if a function's compiled code may yet be replaced by hot code, so
+  /// calls to it have to be late-bound.
+  bool isReplaceable(std::size_t functionIndex);
+
+  /// In warm code, bump one of the function's warm counters, and recompile
+  /// the function once it's hot.
+  void countWarm(TR::IlBuilder *b, std::uint64_t *counter);
+
   // Bytecode Handlers
 
   void handle_bc_function_call(TR::BytecodeBuilder *builder,
@@ -107,6 +192,17 @@ class MethodBuilder : public TR::MethodBuilder {
                      TR::BytecodeBuilder *nextBuilder);
   void handle_bc_call(TR::BytecodeBuilder *builder,
                       TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_push_from_object(TR::BytecodeBuilder *builder,
+                                  TR::BytecodeBuilder *nextBuilder,
+                                  std::size_t bytecodeIndex, Om::Id slotId);
+  void handle_bc_pop_into_object(TR::BytecodeBuilder *builder,
+                                 TR::BytecodeBuilder *nextBuilder,
+                                 std::size_t bytecodeIndex, Om::Id slotId);
+  void handle_bc_jmp_compare(
+      TR::BytecodeBuilder *builder,
+      const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+      const std::vector<Instruction> &program, long bytecodeIndex,
+      TR::BytecodeBuilder *nextBuilder);
   void handle_bc_jmp(
       TR::BytecodeBuilder *builder,
       const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
@@ -143,14 +239,42 @@ class MethodBuilder : public TR::MethodBuilder {
       const std::vector<Instruction> &program, long bytecodeIndex,
       TR::BytecodeBuilder *nextBuilder);
 
+  // Superinstruction Handlers
+
+  void handle_bc_add_local_local(
+      TR::BytecodeBuilder *builder,
+      const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+      const std::vector<Instruction> &program, long bytecodeIndex);
+  void handle_bc_sub_param_constant(
+      TR::BytecodeBuilder *builder,
+      const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+      const std::vector<Instruction> &program, long bytecodeIndex);
+  void handle_bc_jmp_eq_zero(
+      TR::BytecodeBuilder *builder,
+      const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+      const std::vector<Instruction> &program, long bytecodeIndex);
+
   const GlobalTypes &globalTypes() { return globalTypes_; }
 
+  bool isOsr() const { return osrEntry_ != NO_OSR_ENTRY; }
+
+  static constexpr std::size_t NO_OSR_ENTRY = std::size_t(-1);
+
   VirtualMachine &virtualMachine_;
   const GlobalTypes &globalTypes_;
   const Config &cfg_;
   const std::size_t functionIndex_;
+  const std::size_t osrEntry_;
+  const Tier tier_;
+  const bool speculate_;  //< Speculation is enabled, and hasn't failed yet
   std::vector<std::string> params_;
+  std::vector<JitFunction> callees_;  //< Compiled functions, at definition
   std::vector<std::string> locals_;
+  std::deque<InlineFrame> inlineFrames_;
+  const InlineFrame *frame_ = nullptr;  //< The body being generated
+  std::size_t nextBytecodeIndex_ = 0;
+  /// The raw int48 behind each box made since the last merge point.
+  std::unordered_map<TR::IlValue *, TR::IlValue *> unboxedValues_;
   int32_t maxInlineDepth_;
   int32_t firstArgumentIndex = 0;
 };
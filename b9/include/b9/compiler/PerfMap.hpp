@@ -0,0 +1,55 @@
+#if !defined(B9_PERFMAP_HPP_)
+#define B9_PERFMAP_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace b9 {
+
+/// Names jitted code for Linux perf, by appending to /tmp/perf-<pid>.map. Each
+/// line of the map gives the start, size and name of a compiled body. Perf
+/// takes the last line for an address, so lines are never rewritten, only
+/// superseded by later ones.
+///
+/// JitBuilder only hands back the entry point of a body, not its size, so a
+/// body is first given DEFAULT_SIZE. Bodies are allocated one after another in
+/// the code cache. When a later body starts inside an earlier one, the earlier
+/// body's line is appended again, cut off where the later body starts.
+class PerfMap {
+ public:
+  /// The size given to a body until a later body is found inside it.
+  static constexpr std::size_t DEFAULT_SIZE = 0x1000;
+
+  /// Starts an empty map, replacing any map left by this process.
+  PerfMap();
+
+  PerfMap(const PerfMap &) = delete;
+  PerfMap &operator=(const PerfMap &) = delete;
+
+  /// Name the body of code at start. Safe to call from the background
+  /// compile thread.
+  void add(const void *start, const std::string &name);
+
+  const std::string &path() const { return path_; }
+
+ private:
+  struct Body {
+    std::size_t size;
+    std::string name;
+  };
+
+  void append(std::uintptr_t start, const Body &body);
+
+  std::string path_;
+  std::ofstream out_;
+  std::map<std::uintptr_t, Body> bodies_;
+  std::mutex mutex_;
+};
+
+}  // namespace b9
+
+#endif  // B9_PERFMAP_HPP_
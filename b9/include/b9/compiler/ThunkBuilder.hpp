@@ -0,0 +1,31 @@
+#if !defined(B9_THUNKBUILDER_HPP_)
+#define B9_THUNKBUILDER_HPP_
+
+#include "b9/compiler/GlobalTypes.hpp"
+
+#include <ilgen/MethodBuilder.hpp>
+#include <ilgen/TypeDictionary.hpp>
+
+#include <cstddef>
+
+namespace b9 {
+
+/// Builds an interpreter-to-jit transition for pass-param functions of a
+/// single arity. The thunk is called with the execution context, the compiled
+/// function, and a pointer to the arguments on the operand stack. It loads each
+/// argument straight from the stack, and calls the function with C linkage.
+class ThunkBuilder : public TR::MethodBuilder {
+ public:
+  ThunkBuilder(TR::TypeDictionary *types, const GlobalTypes &globalTypes,
+               std::size_t nparams);
+
+  virtual bool buildIL();
+
+ private:
+  const GlobalTypes &globalTypes_;
+  const std::size_t nparams_;
+};
+
+}  // namespace b9
+
+#endif  // B9_THUNKBUILDER_HPP_
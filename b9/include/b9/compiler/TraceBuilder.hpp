@@ -0,0 +1,64 @@
+#if !defined(B9_TRACEBUILDER_HPP_)
+#define B9_TRACEBUILDER_HPP_
+
+#include "b9/Trace.hpp"
+#include "b9/compiler/GlobalTypes.hpp"
+
+#include <ilgen/MethodBuilder.hpp>
+#include <ilgen/TypeDictionary.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace b9 {
+
+class FunctionDef;
+class VirtualMachine;
+
+/// Builds the code for a recorded trace. The trace is compiled as a loop that
+/// works straight on the interpreted frame's params and locals. The operand
+/// stack is modelled, with every value an unboxed int48, since that is all the
+/// recording saw.
+///
+/// Wherever the code could leave the recorded path, a side exit checks that it
+/// doesn't. A load that isn't an int48 exits to the load itself, and a jump
+/// that goes the other way exits to where it goes. Either way, the modelled
+/// stack is written back to the operand stack, and the index of the
+/// instruction to continue at is returned to the interpreter.
+class TraceBuilder : public TR::MethodBuilder {
+ public:
+  TraceBuilder(VirtualMachine &virtualMachine, const Trace &trace);
+
+  virtual bool buildIL();
+
+ private:
+  /// Generate one recorded instruction into b.
+  void generateStep(TR::IlBuilder *b, const TraceStep &step);
+
+  /// The address of a param or local in the interpreted frame.
+  TR::IlValue *slot(TR::IlBuilder *b, const char *frame, std::size_t index);
+
+  /// Load an int48 from a param or local, exiting at bytecodeIndex if the
+  /// value isn't one.
+  TR::IlValue *loadInt48(TR::IlBuilder *b, const char *frame,
+                         std::size_t index, std::size_t bytecodeIndex);
+
+  /// Leave the trace if condition holds, continuing at bytecodeIndex.
+  void exitIf(TR::IlBuilder *b, TR::IlValue *condition,
+              std::size_t bytecodeIndex);
+
+  TR::IlValue *pop() {
+    TR::IlValue *value = stack_.back();
+    stack_.pop_back();
+    return value;
+  }
+
+  const GlobalTypes &globalTypes_;
+  const Trace &trace_;
+  const FunctionDef &function_;
+  std::vector<TR::IlValue *> stack_;  //< Unboxed int48s, bottom first
+};
+
+}  // namespace b9
+
+#endif  // B9_TRACEBUILDER_HPP_
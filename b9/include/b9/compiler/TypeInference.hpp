@@ -0,0 +1,84 @@
+#if !defined(B9_TYPEINFERENCE_HPP_)
+#define B9_TYPEINFERENCE_HPP_
+
+#include "b9/Module.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+namespace b9 {
+
+class VirtualMachine;
+
+/// What the JIT can prove about a value from the bytecode alone.
+enum class ValueType : std::uint8_t {
+  INT48,  //< Always an int48
+  ANY,    //< Could be anything
+};
+
+/// A forward dataflow analysis over one function's bytecode. It works out the
+/// stack depth and the type of every stack slot at each reachable instruction,
+/// and which locals only ever hold int48s. The JIT keeps those locals unboxed.
+///
+/// Arithmetic, comparisons and integer constants always produce int48s.
+/// Params, call results, strings and object slots could be anything. A local
+/// starts out zeroed, which reads as the int48 0.
+class TypeInference {
+ public:
+  TypeInference(VirtualMachine &virtualMachine, const FunctionDef &function);
+
+  /// False if the analysis gave up, because the stack depth disagrees where
+  /// control flow meets, or an instruction's stack effect isn't known. No local
+  /// is an int48 if so.
+  bool ok() const { return ok_; }
+
+  /// True if the local only ever holds int48s.
+  bool isInt48Local(std::size_t index) const {
+    return ok_ && int48Locals_[index];
+  }
+
+  /// True if every return leaves exactly the result on the stack.
+  bool hasBalancedReturns() const { return ok_ && balancedReturns_; }
+
+  /// True if control can reach the instruction from more than one place.
+  /// Always true if the analysis gave up.
+  bool isMergePoint(std::size_t index) const {
+    return !ok_ || predecessors_[index].size() > 1;
+  }
+
+  /// True if the instruction is the target of a backward jump.
+  bool isLoopHeader(std::size_t index) const {
+    if (!ok_) return false;
+    // ENTRY sorts last, after any real predecessor.
+    auto backward = predecessors_[index].lower_bound(index);
+    return backward != predecessors_[index].end() && *backward != ENTRY;
+  }
+
+  /// The types on the stack before an instruction runs, bottom first. Empty
+  /// for an instruction that is never reached.
+  const std::vector<ValueType> &stackTypes(std::size_t index) const {
+    return entries_[index];
+  }
+
+ private:
+  static constexpr std::size_t ENTRY = std::size_t(-1);
+
+  /// Run the analysis to a fixed point. Instructions are revisited only when
+  /// what flows into them widens, so each is visited a bounded number of times.
+  void analyze();
+
+  VirtualMachine &virtualMachine_;
+  const FunctionDef &function_;
+  bool ok_ = true;
+  bool balancedReturns_ = true;
+  std::vector<bool> int48Locals_;
+  std::vector<bool> reached_;
+  std::vector<std::vector<ValueType>> entries_;
+  std::vector<std::set<std::size_t>> predecessors_;
+};
+
+}  // namespace b9
+
+#endif  // B9_TYPEINFERENCE_HPP_
@@ -81,6 +81,21 @@ enum class OpCode : RawOpCode {
   CALL_INDIRECT = 0x23,
 
   SYSTEM_COLLECT = 0x24,
+
+  // Superinstructions
+
+  // Superinstructions are internal to the VM. They are never emitted by the
+  // compiler, or serialized. A superinstruction replaces the first
+  // instruction of the sequence it fuses, and the rest of the sequence is left
+  // in place, so jump offsets are unchanged. The immediates of a fused
+  // sequence are read from the original instructions.
+
+  // Fuses: PUSH_FROM_LOCAL a; PUSH_FROM_LOCAL b; INT_ADD
+  INT_ADD_LOCAL_LOCAL = 0x30,
+  // Fuses: PUSH_FROM_PARAM a; INT_PUSH_CONSTANT c; INT_SUB
+  INT_SUB_PARAM_CONSTANT = 0x31,
+  // Fuses: INT_PUSH_CONSTANT 0; JMP_EQ delta
+  JMP_EQ_ZERO = 0x32,
 };
 
 inline const char *toString(OpCode bc) {
@@ -143,6 +158,12 @@ inline const char *toString(OpCode bc) {
       return "call_indirect";
     case OpCode::SYSTEM_COLLECT:
       return "system_collect";
+    case OpCode::INT_ADD_LOCAL_LOCAL:
+      return "int_add_local_local";
+    case OpCode::INT_SUB_PARAM_CONSTANT:
+      return "int_sub_param_constant";
+    case OpCode::JMP_EQ_ZERO:
+      return "jmp_eq_zero";
     default:
       return "UNKNOWN_BYTECODE";
   }
@@ -269,6 +290,9 @@ inline std::ostream &operator<<(std::ostream &out, Instruction i) {
     case OpCode::STR_PUSH_CONSTANT:
     case OpCode::PUSH_FROM_OBJECT:
     case OpCode::POP_INTO_OBJECT:
+    case OpCode::INT_ADD_LOCAL_LOCAL:
+    case OpCode::INT_SUB_PARAM_CONSTANT:
+    case OpCode::JMP_EQ_ZERO:
     default:
       out << " " << i.immediate();
       break;
@@ -0,0 +1,125 @@
+#include <b9/CallProfile.hpp>
+
+#include <algorithm>
+#include <iomanip>
+
+namespace b9 {
+
+constexpr std::size_t CallProfile::ROOT;
+
+/// The most rows printed in the edge table.
+static constexpr std::size_t EDGE_ROWS = 20;
+
+void CallProfile::enter(std::size_t functionIndex) {
+  std::size_t caller = stack_.empty() ? ROOT : stack_.back().functionIndex;
+  edges_[{caller, functionIndex}]++;
+  Function &callee = function(functionIndex);
+  callee.calls++;
+  callee.active++;
+  stack_.push_back({functionIndex, Clock::now(), 0});
+}
+
+void CallProfile::exit() {
+  Active call = stack_.back();
+  stack_.pop_back();
+  std::uint64_t elapsed =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                           call.start)
+          .count();
+
+  Function &callee = function(call.functionIndex);
+  callee.active--;
+  if (callee.active == 0) {
+    callee.inclusive += elapsed;
+  }
+  callee.exclusive += elapsed - std::min(elapsed, call.callees);
+  if (!stack_.empty()) {
+    stack_.back().callees += elapsed;
+  }
+}
+
+std::uint64_t CallProfile::calls(std::size_t functionIndex) const {
+  return functionIndex < functions_.size() ? functions_[functionIndex].calls
+                                           : 0;
+}
+
+std::uint64_t CallProfile::inclusive(std::size_t functionIndex) const {
+  return functionIndex < functions_.size()
+             ? functions_[functionIndex].inclusive
+             : 0;
+}
+
+std::uint64_t CallProfile::exclusive(std::size_t functionIndex) const {
+  return functionIndex < functions_.size()
+             ? functions_[functionIndex].exclusive
+             : 0;
+}
+
+std::uint64_t CallProfile::edgeCount(std::size_t caller,
+                                     std::size_t callee) const {
+  auto edge = edges_.find({caller, callee});
+  return edge == edges_.end() ? 0 : edge->second;
+}
+
+/// The name of a function, or <native> for ROOT.
+static const std::string &functionName(const Module &module,
+                                       std::size_t functionIndex) {
+  static const std::string native = "<native>";
+  if (functionIndex == CallProfile::ROOT) {
+    return native;
+  }
+  return module.functions[functionIndex].name;
+}
+
+void CallProfile::print(std::ostream &out, const Module &module) const {
+  auto flags = out.flags();
+  auto precision = out.precision();
+
+  std::uint64_t total = 0;
+  std::vector<std::size_t> ranked;
+  for (std::size_t i = 0; i < functions_.size(); i++) {
+    total += functions_[i].exclusive;
+    if (functions_[i].calls != 0) ranked.push_back(i);
+  }
+  std::stable_sort(ranked.begin(), ranked.end(),
+                   [this](std::size_t a, std::size_t b) {
+                     return functions_[a].exclusive > functions_[b].exclusive;
+                   });
+
+  out << std::left << std::setw(24) << "Function" << std::right
+      << std::setw(12) << "Calls" << std::setw(16) << "Inclusive ms"
+      << std::setw(16) << "Exclusive ms" << std::setw(8) << "%" << std::endl
+      << std::fixed;
+  for (auto i : ranked) {
+    const Function &function = functions_[i];
+    out << std::left << std::setw(24) << functionName(module, i) << std::right
+        << std::setw(12) << function.calls << std::setprecision(3)
+        << std::setw(16) << function.inclusive / 1e6 << std::setw(16)
+        << function.exclusive / 1e6 << std::setprecision(2) << std::setw(8)
+        << (total ? 100.0 * function.exclusive / total : 0.0) << std::endl;
+  }
+
+  std::vector<std::pair<std::pair<std::size_t, std::size_t>, std::uint64_t>>
+      edges(edges_.begin(), edges_.end());
+  std::stable_sort(edges.begin(), edges.end(),
+                   [](const decltype(edges)::value_type &a,
+                      const decltype(edges)::value_type &b) {
+                     return a.second > b.second;
+                   });
+  edges.resize(std::min(edges.size(), EDGE_ROWS));
+
+  out << std::endl
+      << std::left << std::setw(48) << "Call" << std::right << std::setw(12)
+      << "Calls" << std::endl;
+  for (const auto &edge : edges) {
+    std::string name = functionName(module, edge.first.first) + " -> " +
+                       functionName(module, edge.first.second);
+    out << std::left << std::setw(48) << name << std::right << std::setw(12)
+        << edge.second << std::endl;
+  }
+
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}  // namespace b9
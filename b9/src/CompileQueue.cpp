@@ -0,0 +1,93 @@
+#include <b9/CompileQueue.hpp>
+
+#include <algorithm>
+
+namespace b9 {
+
+std::ostream &operator<<(std::ostream &out, const CompileStatistics &stats) {
+  using std::chrono::microseconds;
+  using std::chrono::duration_cast;
+
+  microseconds average(0);
+  if (stats.completed != 0) {
+    average = duration_cast<microseconds>(stats.totalLatency) /
+              static_cast<std::int64_t>(stats.completed);
+  }
+
+  out << "Compile requests:   " << stats.requests << std::endl
+      << "Compiles completed: " << stats.completed << std::endl
+      << "Max queue depth:    " << stats.maxDepth << std::endl
+      << "Average latency:    " << average.count() << "us" << std::endl
+      << "Max latency:        "
+      << duration_cast<microseconds>(stats.maxLatency).count() << "us";
+  return out;
+}
+
+CompileQueue::CompileQueue(CompileFunction compile)
+    : compile_(std::move(compile)), thread_(&CompileQueue::run, this) {}
+
+CompileQueue::~CompileQueue() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+void CompileQueue::request(std::size_t functionIndex) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requests_.push_back({functionIndex, Clock::now()});
+    statistics_.requests++;
+    statistics_.maxDepth = std::max(statistics_.maxDepth, requests_.size());
+  }
+  wake_.notify_one();
+}
+
+void CompileQueue::drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return requests_.empty() && !busy_; });
+}
+
+std::size_t CompileQueue::depth() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return requests_.size();
+}
+
+CompileStatistics CompileQueue::statistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return statistics_;
+}
+
+void CompileQueue::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true) {
+    wake_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+    if (stopping_) {
+      return;
+    }
+
+    Request request = requests_.front();
+    requests_.pop_front();
+    busy_ = true;
+
+    lock.unlock();
+    compile_(request.functionIndex);
+    auto latency = Clock::now() - request.requested;
+    lock.lock();
+
+    busy_ = false;
+    statistics_.completed++;
+    statistics_.totalLatency += latency;
+    statistics_.maxLatency = std::max<std::chrono::nanoseconds>(
+        statistics_.maxLatency, latency);
+
+    if (requests_.empty()) {
+      idle_.notify_all();
+    }
+  }
+}
+
+}  // namespace b9
@@ -3,6 +3,8 @@
 #include "b9/VirtualMachine.hpp"
 #include "b9/compiler/GlobalTypes.hpp"
 #include "b9/compiler/MethodBuilder.hpp"
+#include "b9/compiler/ThunkBuilder.hpp"
+#include "b9/compiler/TraceBuilder.hpp"
 #include "b9/instructions.hpp"
 
 #include <dlfcn.h>
@@ -14,6 +16,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <iterator>
 #include <sstream>
 #include <vector>
 
@@ -27,6 +30,7 @@ GlobalTypes::GlobalTypes(TR::TypeDictionary &td) {
   int64Ptr = td.PointerTo(TR::Int64);
   int32Ptr = td.PointerTo(TR::Int32);
   int16Ptr = td.PointerTo(TR::Int16);
+  int8Ptr = td.PointerTo(TR::Int8);
 
   // Basic VM Data
 
@@ -56,17 +60,59 @@ GlobalTypes::GlobalTypes(TR::TypeDictionary &td) {
   td.CloseStruct(ec);
 
   executionContextPtr = td.PointerTo(executionContext);
+
+  // Om Structures
+
+  // Only the layout is read by compiled code. It's the first word of every
+  // object, and is compared against the shapes in a PropertyCache.
+  auto obj = "OMR::Om::Object";
+  object = td.DefineStruct(obj);
+  td.DefineField(obj, "layout_", TR::Address, 0);
+  td.CloseStruct(obj);
+
+  objectPtr = td.PointerTo(object);
 }
 
 Compiler::Compiler(VirtualMachine &virtualMachine, const Config &cfg)
     : typeDictionary_(),
       globalTypes_(typeDictionary_),
       virtualMachine_(virtualMachine),
-      cfg_(cfg) {}
+      cfg_(cfg) {
+  if (cfg_.perfMap) {
+    perfMap_.reset(new PerfMap());
+    if (cfg_.verbose) {
+      std::cout << "Writing perf map: " << perfMap_->path() << std::endl;
+    }
+  }
+}
+
+void Compiler::nameCode(const void *start, const std::string &name) {
+  {
+    std::lock_guard<std::mutex> lock(bodiesMutex_);
+    bodies_[reinterpret_cast<std::uintptr_t>(start)] = name;
+  }
+  if (perfMap_) {
+    perfMap_->add(start, "b9::" + name);
+  }
+}
+
+std::string Compiler::findCode(std::uintptr_t pc) const {
+  std::lock_guard<std::mutex> lock(bodiesMutex_);
+  auto next = bodies_.upper_bound(pc);
+  if (next == bodies_.begin()) {
+    return "";
+  }
+  auto body = std::prev(next);
+  if (pc - body->first >= PerfMap::DEFAULT_SIZE) {
+    return "";
+  }
+  return body->second;
+}
 
-JitFunction Compiler::generateCode(const std::size_t functionIndex) {
+JitFunction Compiler::generateCode(const std::size_t functionIndex,
+                                   const Tier tier) {
   const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
-  MethodBuilder methodBuilder(virtualMachine_, functionIndex);
+  MethodBuilder methodBuilder(virtualMachine_, functionIndex, tier);
 
   if (cfg_.verbose)
     std::cout << "MethodBuilder for function: " << function->name
@@ -81,6 +127,14 @@ JitFunction Compiler::generateCode(const std::size_t functionIndex) {
     throw b9::CompilationException{"IL generation failed"};
   }
 
+  std::string name = function->name;
+  if (tier == Tier::WARM) {
+    name += " [warm]";
+  } else if (tier == Tier::HOT) {
+    name += " [hot]";
+  }
+  nameCode(result, name);
+
   if (cfg_.verbose)
     std::cout << "Compilation completed with return code: " << rc
               << ", code address: " << static_cast<void *>(result) << std::endl;
@@ -88,4 +142,67 @@ JitFunction Compiler::generateCode(const std::size_t functionIndex) {
   return (JitFunction)result;
 }
 
+OsrFunction Compiler::generateOsrCode(const std::size_t functionIndex,
+                                      const std::size_t entry) {
+  const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
+  MethodBuilder methodBuilder(virtualMachine_, functionIndex, entry);
+
+  if (cfg_.verbose)
+    std::cout << "MethodBuilder for OSR into function: " << function->name
+              << " at: " << entry << " is constructed" << std::endl;
+
+  uint8_t *result = nullptr;
+  auto rc = compileMethodBuilder(&methodBuilder, &result);
+
+  if (rc != 0) {
+    std::cout << "Failed to compile OSR entry for function: " << function->name
+              << " at: " << entry << std::endl;
+    throw b9::CompilationException{"IL generation failed"};
+  }
+
+  nameCode(result, function->name + " [osr@" + std::to_string(entry) + "]");
+
+  return (OsrFunction)result;
+}
+
+TraceFunction Compiler::generateTraceCode(const Trace &trace) {
+  TraceBuilder traceBuilder(virtualMachine_, trace);
+
+  uint8_t *result = nullptr;
+  auto rc = compileMethodBuilder(&traceBuilder, &result);
+
+  if (rc != 0) {
+    std::cout << "Failed to compile trace for function: "
+              << virtualMachine_.getFunction(trace.functionIndex)->name
+              << " at: " << trace.header << std::endl;
+    throw b9::CompilationException{"IL generation failed"};
+  }
+
+  nameCode(result, virtualMachine_.getFunction(trace.functionIndex)->name +
+                       " [trace@" + std::to_string(trace.header) + "]");
+
+  return (TraceFunction)result;
+}
+
+JitThunk Compiler::generateThunk(const std::size_t nparams) {
+  ThunkBuilder thunkBuilder(&typeDictionary_, globalTypes_, nparams);
+
+  uint8_t *result = nullptr;
+  auto rc = compileMethodBuilder(&thunkBuilder, &result);
+
+  if (rc != 0) {
+    std::cout << "Failed to compile thunk for nparams: " << nparams
+              << std::endl;
+    throw b9::CompilationException{"IL generation failed"};
+  }
+
+  nameCode(result, "jit_thunk_" + std::to_string(nparams));
+
+  if (cfg_.verbose)
+    std::cout << "Compiled thunk for nparams: " << nparams
+              << ", code address: " << static_cast<void *>(result) << std::endl;
+
+  return (JitThunk)result;
+}
+
 }  // namespace b9
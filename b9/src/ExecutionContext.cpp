@@ -1,4 +1,5 @@
 #include <b9/ExecutionContext.hpp>
+#include <b9/Superinstructions.hpp>
 #include <b9/VirtualMachine.hpp>
 #include <b9/compiler/Compiler.hpp>
 
@@ -12,10 +13,12 @@
 #include <OMR/Om/Value.hpp>
 
 #include <sys/time.h>
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -25,19 +28,42 @@ namespace b9 {
 ExecutionContext::ExecutionContext(VirtualMachine &virtualMachine,
                                    const Config &cfg)
     : omContext_(virtualMachine.memoryManager()),
+      stack_(cfg.stackSize),
+      callStack_(cfg.maxCallDepth),
       virtualMachine_(&virtualMachine),
       cfg_(&cfg) {
   omContext().userMarkingFns().push_back(
       [this](Om::MarkingVisitor &v) { this->visit(v); });
+  // Inline caches hold untraced shape pointers. Drop them whenever the GC runs.
+  omContext().userMarkingFns().push_back([this](Om::MarkingVisitor &) {
+    virtualMachine_->flushPropertyCaches();
+  });
+}
+
+template <typename Compare>
+bool ExecutionContext::compare(StackElement left, StackElement right,
+                               Compare predicate) {
+  if (right.isInt48() && left.isInt48()) {
+    return predicate(left.getInt48(), right.getInt48());
+  } else if (right.isUint48() && left.isUint48()) {
+    const auto &strRight = virtualMachine_->getString(right.getUint48());
+    const auto &strLeft = virtualMachine_->getString(left.getUint48());
+    return predicate(strLeft, strRight);
+  } else {
+    throw std::runtime_error("Operands for comparison not of same type.");
+  }
 }
 
 void ExecutionContext::reset() {
   stack_.reset();
+  callStack_.reset();
   programCounter_ = 0;
 }
 
-Om::Value ExecutionContext::callJitFunction(JitFunction jitFunction,
+Om::Value ExecutionContext::callJitFunction(std::size_t functionIndex,
+                                            JitFunction jitFunction,
                                             std::size_t nparams) {
+  ShadowFrame shadowFrame(shadowFrameTop(), functionIndex, nullptr);
   Om::RawValue result = 0;
 
   if (cfg_->passParam) {
@@ -45,29 +71,11 @@ Om::Value ExecutionContext::callJitFunction(JitFunction jitFunction,
       std::cout << "Int: transition to Jit(PP): " << (void *)jitFunction
                 << std::endl;
     }
-    switch (nparams) {
-      case 0: {
-        result = jitFunction(this);
-      } break;
-      case 1: {
-        StackElement p1 = pop();
-        result = jitFunction(this, p1.raw());
-      } break;
-      case 2: {
-        StackElement p2 = pop();
-        StackElement p1 = pop();
-        result = jitFunction(this, p1.raw(), p2.raw());
-      } break;
-      case 3: {
-        StackElement p3 = pop();
-        StackElement p2 = pop();
-        StackElement p1 = pop();
-        result = (*jitFunction)(this, p1.raw(), p2.raw(), p3.raw());
-      } break;
-      default:
-        throw std::runtime_error{"Need to add handlers for more parameters"};
-        break;
-    }
+    // The thunk reads the arguments straight off the operand stack.
+    StackElement *args = stack_.top() - nparams;
+    JitThunk thunk = virtualMachine_->getJitThunk(nparams);
+    result = thunk(this, jitFunction, args);
+    stack_.restore(args);
   } else {
     if (cfg_->verbose) {
       std::cout << "Int: transition to Jit: " << (void *)jitFunction
@@ -80,29 +88,89 @@ Om::Value ExecutionContext::callJitFunction(JitFunction jitFunction,
 }
 
 StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
+  CallProfile::Call call(virtualMachine_->callProfile(), functionIndex);
   auto function = virtualMachine_->getFunction(functionIndex);
   auto paramsCount = function->nparams;
   auto localsCount = function->nlocals;
   auto jitFunction = virtualMachine_->getJitAddress(functionIndex);
 
+  if (jitFunction == nullptr && cfg_->tiered) {
+    jitFunction = virtualMachine_->countInvocation(functionIndex);
+  }
+
   if (cfg_->debug) {
     std::cerr << "intepret: " << function->name
               << " nparams: " << function->nparams << std::endl;
   }
 
   if (jitFunction) {
-    return callJitFunction(jitFunction, paramsCount);
+    return callJitFunction(functionIndex, jitFunction, paramsCount);
   }
 
-  // interpret the method otherwise
-  const Instruction *instructionPointer = function->instructions.data();
+#if defined(B9_COMPUTED_GOTO)
+  if (cfg_->threaded) {
+    return interpretThreaded(functionIndex);
+  }
+#endif  // B9_COMPUTED_GOTO
 
+  // interpret the method otherwise
   StackElement *params = stack_.top() - paramsCount;
 
   stack_.pushn(localsCount);  // make room for locals in the stack
   StackElement *locals = stack_.top() - localsCount;
 
+  return run(functionIndex, function->instructions.data(), params, locals);
+}
+
+StackElement ExecutionContext::resume(const std::size_t functionIndex,
+                                      const std::size_t bytecodeIndex,
+                                      StackElement *stackBase,
+                                      StackElement *operandBase) {
+  auto function = virtualMachine_->getFunction(functionIndex);
+  virtualMachine_->deoptimized(functionIndex);
+
+  if (cfg_->verbose) {
+    std::cout << "Deoptimizing function: " << function->name
+              << " at: " << bytecodeIndex << std::endl;
+  }
+
+  // The compiled code left its operand stack, then its params and locals.
+  // Move the params and locals under the operand stack, where the interpreter
+  // keeps them.
+  StackElement *top = stack_.top();
+  std::rotate(operandBase, top - function->nparams - function->nlocals, top);
+  StackElement *params = operandBase;
+  StackElement *locals = params + function->nparams;
+
+  auto result = run(functionIndex, &function->instructions[bytecodeIndex],
+                    params, locals);
+
+  // The interpreter popped its copy of the params. Pop the caller's too.
+  stack_.restore(stackBase);
+  return result;
+}
+
+StackElement ExecutionContext::run(const std::size_t functionIndex,
+                                   const Instruction *instructionPointer,
+                                   StackElement *params,
+                                   StackElement *locals) {
+  auto function = virtualMachine_->getFunction(functionIndex);
+  ShadowFrame shadowFrame(shadowFrameTop(), functionIndex,
+                          function->instructions.data());
+  const bool sampled = shadowFrame.linked();
+
+#if defined(B9_OPSTATS)
+  OpStats::Frame opStats(virtualMachine_->opStats(), functionIndex);
+#endif  // B9_OPSTATS
+
   while (*instructionPointer != END_SECTION) {
+    if (sampled) {
+      shadowFrame.step(instructionPointer);
+    }
+#if defined(B9_OPSTATS)
+    opStats.step(instructionPointer - function->instructions.data(),
+                 instructionPointer->opCode());
+#endif  // B9_OPSTATS
     switch (instructionPointer->opCode()) {
       case OpCode::FUNCTION_CALL:
         doFunctionCall(instructionPointer->immediate());
@@ -117,6 +185,24 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
         doPrimitiveCall(instructionPointer->immediate());
         break;
       case OpCode::JMP:
+        // Loops are closed by a backward JMP.
+        if (instructionPointer->immediate() < 0) {
+          std::size_t target = instructionPointer -
+                               function->instructions.data() +
+                               instructionPointer->immediate() + 1;
+          if (cfg_->traceJit) {
+            instructionPointer = doLoop(functionIndex, target, params, locals);
+            continue;
+          }
+          if (cfg_->tiered) {
+            auto osrFunction =
+                virtualMachine_->countBackEdge(functionIndex, target);
+            if (osrFunction) {
+              // The compiled code finishes the call, and pops the frame.
+              return Om::Value(Om::AS_RAW, osrFunction(this, locals));
+            }
+          }
+        }
         instructionPointer += instructionPointer->immediate();
         break;
       case OpCode::DUPLICATE:
@@ -191,6 +277,21 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
       case OpCode::SYSTEM_COLLECT:
         doSystemCollect();
         break;
+      case OpCode::INT_ADD_LOCAL_LOCAL:
+        doIntAddLocalLocal(locals, instructionPointer[0].immediate(),
+                           instructionPointer[1].immediate());
+        instructionPointer += 2;
+        break;
+      case OpCode::INT_SUB_PARAM_CONSTANT:
+        doIntSubParamConstant(params, instructionPointer[0].immediate(),
+                              instructionPointer[1].immediate());
+        instructionPointer += 2;
+        break;
+      case OpCode::JMP_EQ_ZERO:
+        // The jump is the second instruction of the sequence.
+        instructionPointer += 1;
+        instructionPointer += doJmpEqZero(instructionPointer->immediate());
+        break;
       default:
         assert(false);
         break;
@@ -201,6 +302,538 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
   throw std::runtime_error("Reached end of function");
 }
 
+const Instruction *ExecutionContext::doLoop(const std::size_t functionIndex,
+                                            const std::size_t header,
+                                            StackElement *params,
+                                            StackElement *locals) {
+  const Instruction *program =
+      virtualMachine_->getFunction(functionIndex)->instructions.data();
+  bool record = false;
+  auto trace = virtualMachine_->countLoop(functionIndex, header, record);
+  if (trace) {
+    return program + trace(this, params, locals);
+  }
+  if (record) {
+    return recordTrace(functionIndex, header, params, locals);
+  }
+  return program + header;
+}
+
+/// The number of values an instruction pops, if it can be traced.
+static bool traceArity(OpCode op, std::size_t &arity) {
+  switch (op) {
+    case OpCode::JMP:
+    case OpCode::PUSH_FROM_LOCAL:
+    case OpCode::PUSH_FROM_PARAM:
+    case OpCode::INT_PUSH_CONSTANT:
+      arity = 0;
+      return true;
+    case OpCode::DUPLICATE:
+    case OpCode::DROP:
+    case OpCode::POP_INTO_LOCAL:
+    case OpCode::POP_INTO_PARAM:
+    case OpCode::INT_NOT:
+      arity = 1;
+      return true;
+    case OpCode::INT_ADD:
+    case OpCode::INT_SUB:
+    case OpCode::INT_MUL:
+    case OpCode::INT_DIV:
+    case OpCode::JMP_EQ:
+    case OpCode::JMP_NEQ:
+    case OpCode::JMP_GT:
+    case OpCode::JMP_GE:
+    case OpCode::JMP_LT:
+    case OpCode::JMP_LE:
+      arity = 2;
+      return true;
+    default:
+      return false;
+  }
+}
+
+const Instruction *ExecutionContext::recordTrace(
+    const std::size_t functionIndex, const std::size_t header,
+    StackElement *params, StackElement *locals) {
+  const Instruction *program =
+      virtualMachine_->getFunction(functionIndex)->instructions.data();
+  const Instruction *instructionPointer = program + header;
+  StackElement *base = stack_.top();
+  Trace trace{functionIndex, header, {}};
+
+  if (cfg_->verbose) {
+    std::cout << "Recording trace: "
+              << virtualMachine_->getFunction(functionIndex)->name
+              << " at: " << header << std::endl;
+  }
+
+  // Only values made in the iteration are int48 for sure, so the iteration
+  // must not pop below where it started. Superinstructions are recorded as
+  // the instructions they fuse, one step each.
+  do {
+    const Instruction instruction = *instructionPointer;
+    const OpCode op = unfused(instruction.opCode());
+    std::size_t arity = 0;
+    if (trace.steps.size() == MAX_TRACE_LENGTH ||
+        !traceArity(op, arity) ||
+        std::size_t(stack_.top() - base) < arity) {
+      return instructionPointer;
+    }
+
+    TraceStep step{std::size_t(instructionPointer - program), false};
+    switch (op) {
+      case OpCode::JMP:
+        instructionPointer += instruction.immediate();
+        break;
+      case OpCode::DUPLICATE:
+        doDuplicate();
+        break;
+      case OpCode::DROP:
+        doDrop();
+        break;
+      case OpCode::PUSH_FROM_LOCAL:
+        if (!locals[instruction.immediate()].isInt48()) {
+          return instructionPointer;
+        }
+        doPushFromLocal(locals, instruction.immediate());
+        break;
+      case OpCode::POP_INTO_LOCAL:
+        doPopIntoLocal(locals, instruction.immediate());
+        break;
+      case OpCode::PUSH_FROM_PARAM:
+        if (!params[instruction.immediate()].isInt48()) {
+          return instructionPointer;
+        }
+        doPushFromParam(params, instruction.immediate());
+        break;
+      case OpCode::POP_INTO_PARAM:
+        doPopIntoParam(params, instruction.immediate());
+        break;
+      case OpCode::INT_ADD:
+        doIntAdd();
+        break;
+      case OpCode::INT_SUB:
+        doIntSub();
+        break;
+      case OpCode::INT_MUL:
+        doIntMul();
+        break;
+      case OpCode::INT_DIV:
+        doIntDiv();
+        break;
+      case OpCode::INT_PUSH_CONSTANT:
+        doIntPushConstant(instruction.immediate());
+        break;
+      case OpCode::INT_NOT:
+        doIntNot();
+        break;
+      default: {
+        // A conditional jump.
+        auto right = stack_.pop();
+        auto left = stack_.pop();
+        step.taken = doCompare(op, left, right);
+        if (step.taken) {
+          instructionPointer += instruction.immediate();
+        }
+        break;
+      }
+    }
+    trace.steps.push_back(step);
+    instructionPointer++;
+  } while (instructionPointer != program + header);
+
+  if (stack_.top() == base) {
+    virtualMachine_->compileTrace(trace);
+  }
+  return instructionPointer;
+}
+
+#if defined(B9_COMPUTED_GOTO)
+
+StackElement ExecutionContext::interpretThreaded(
+    const std::size_t functionIndex) {
+  // One entry per OpCode, indexed by the raw opcode value.
+  static const void *const dispatchTable[] = {
+      &&END_SECTION,             // 0x00
+      &&FUNCTION_CALL,           // 0x01
+      &&FUNCTION_RETURN,         // 0x02
+      &&PRIMITIVE_CALL,          // 0x03
+      &&JMP,                     // 0x04
+      &&DUPLICATE,               // 0x05
+      &&DROP,                    // 0x06
+      &&PUSH_FROM_LOCAL,         // 0x07
+      &&POP_INTO_LOCAL,          // 0x08
+      &&PUSH_FROM_PARAM,         // 0x09
+      &&POP_INTO_PARAM,          // 0x0a
+      &&INT_ADD,                 // 0x0b
+      &&INT_SUB,                 // 0x0c
+      &&INT_MUL,                 // 0x0d
+      &&INT_DIV,                 // 0x0e
+      &&INT_PUSH_CONSTANT,       // 0x0f
+      &&INT_NOT,                 // 0x10
+      &&JMP_EQ,                  // 0x11
+      &&JMP_NEQ,                 // 0x12
+      &&JMP_GT,                  // 0x13
+      &&JMP_GE,                  // 0x14
+      &&JMP_LT,                  // 0x15
+      &&JMP_LE,                  // 0x16
+      &&STR_PUSH_CONSTANT,       // 0x17
+      &&UNKNOWN,                 // 0x18
+      &&UNKNOWN,                 // 0x19
+      &&UNKNOWN,                 // 0x1a
+      &&UNKNOWN,                 // 0x1b
+      &&UNKNOWN,                 // 0x1c
+      &&UNKNOWN,                 // 0x1d
+      &&UNKNOWN,                 // 0x1e
+      &&UNKNOWN,                 // 0x1f
+      &&NEW_OBJECT,              // 0x20
+      &&PUSH_FROM_OBJECT,        // 0x21
+      &&POP_INTO_OBJECT,         // 0x22
+      &&CALL_INDIRECT,           // 0x23
+      &&SYSTEM_COLLECT,          // 0x24
+      &&UNKNOWN,                 // 0x25
+      &&UNKNOWN,                 // 0x26
+      &&UNKNOWN,                 // 0x27
+      &&UNKNOWN,                 // 0x28
+      &&UNKNOWN,                 // 0x29
+      &&UNKNOWN,                 // 0x2a
+      &&UNKNOWN,                 // 0x2b
+      &&UNKNOWN,                 // 0x2c
+      &&UNKNOWN,                 // 0x2d
+      &&UNKNOWN,                 // 0x2e
+      &&UNKNOWN,                 // 0x2f
+      &&INT_ADD_LOCAL_LOCAL,     // 0x30
+      &&INT_SUB_PARAM_CONSTANT,  // 0x31
+      &&JMP_EQ_ZERO,             // 0x32
+  };
+
+  static constexpr std::size_t DISPATCH_TABLE_SIZE =
+      sizeof(dispatchTable) / sizeof(dispatchTable[0]);
+
+  const ThreadedInstruction *instructionPointer;
+  StackElement *params;
+  StackElement *locals;
+
+  // The top of the operand stack is cached in stackTop, and the rest of the
+  // stack is in memory, below sp. At the entry of each frame the cache holds a
+  // placeholder, which is written to the stack on the first push.
+  StackElement *sp;
+  StackElement stackTop;
+
+  // Frames below the entry depth belong to native callers. If we exit through
+  // an exception, discard the frames pushed by this invocation.
+  const std::size_t entryDepth = callStack_.depth();
+  struct Unwind {
+    CallStack &callStack;
+    std::size_t depth;
+    ~Unwind() { callStack.unwind(depth); }
+  } unwind{callStack_, entryDepth};
+
+// Jump to the handler for the current instruction.
+#define DISPATCH() goto *instructionPointer->handler
+
+// Advance to, and jump to the handler for, the next instruction.
+#define NEXT()            \
+  do {                    \
+    ++instructionPointer; \
+    DISPATCH();           \
+  } while (0)
+
+// Jump to the current instruction's target if the condition holds.
+#define JUMP_IF(condition)                             \
+  do {                                                 \
+    if (condition) {                                   \
+      instructionPointer = instructionPointer->target; \
+      DISPATCH();                                      \
+    }                                                  \
+    NEXT();                                            \
+  } while (0)
+
+// Push a value, moving the old top of stack into memory.
+#define PUSH(value)   \
+  do {                \
+    *sp++ = stackTop; \
+    stackTop = value; \
+  } while (0)
+
+// Drop the top of stack, and reload the cache from memory.
+#define DROP_TOP() (stackTop = *--sp)
+
+// Write the cached top of stack back to the OperandStack. The stack must be
+// spilled before anything that can observe it: calls, primitives, and
+// allocations, which may GC.
+#define SPILL()         \
+  do {                  \
+    *sp++ = stackTop;   \
+    stack_.restore(sp); \
+  } while (0)
+
+// Reload the cache after the OperandStack has been used directly.
+#define RELOAD()       \
+  do {                 \
+    sp = stack_.top(); \
+    stackTop = *--sp;  \
+  } while (0)
+
+// Push a frame for the function at index, and jump to its first instruction.
+// The function's arguments are on top of the OperandStack.
+#define ENTER_FRAME(index, returnAddress)                                 \
+  do {                                                                    \
+    auto function = virtualMachine_->getFunction(index);                  \
+    ThreadedFunction &threaded = virtualMachine_->getThreadedCode(index); \
+    if (threaded.empty()) {                                               \
+      threaded = translate(*function, dispatchTable, DISPATCH_TABLE_SIZE, \
+                           &&UNKNOWN);                                    \
+    }                                                                     \
+    params = stack_.top() - function->nparams;                            \
+    stack_.pushn(function->nlocals);                                      \
+    locals = stack_.top() - function->nlocals;                            \
+    callStack_.push({std::size_t(index), params, locals, returnAddress}); \
+    sp = stack_.top();                                                    \
+    stackTop = StackElement{Om::AS_INT48, 0};                             \
+    instructionPointer = threaded.code.data();                            \
+    DISPATCH();                                                           \
+  } while (0)
+
+// Run a handler that works on the OperandStack.
+#define SPILLED(handler) \
+  do {                   \
+    SPILL();             \
+    handler;             \
+    RELOAD();            \
+  } while (0)
+
+// ( left right -- left<op>right )
+#define INT_BINARY_OP(op)                                               \
+  do {                                                                  \
+    auto left = (--sp)->getInt48();                                     \
+    stackTop = StackElement{Om::AS_INT48, left op stackTop.getInt48()}; \
+  } while (0)
+
+// ( left right -- )
+#define JUMP_IF_COMPARE(predicate)            \
+  do {                                        \
+    auto right = stackTop;                    \
+    auto left = *--sp;                        \
+    DROP_TOP();                               \
+    JUMP_IF(compare(left, right, predicate)); \
+  } while (0)
+
+  ENTER_FRAME(functionIndex, nullptr);
+
+FUNCTION_CALL: {
+  const std::size_t target = instructionPointer->immediate;
+  SPILL();
+  if (cfg_->jit) {
+    auto jitFunction = virtualMachine_->getJitAddress(target);
+    if (jitFunction == nullptr && cfg_->tiered) {
+      jitFunction = virtualMachine_->countInvocation(target);
+    }
+    if (jitFunction) {
+      auto nparams = virtualMachine_->getFunction(target)->nparams;
+      push(callJitFunction(target, jitFunction, nparams));
+      RELOAD();
+      NEXT();
+    }
+  }
+  ENTER_FRAME(target, instructionPointer + 1);
+}
+
+FUNCTION_RETURN: {
+  auto result = stackTop;
+  Frame callee = callStack_.pop();
+  sp = callee.params;
+  if (callee.returnAddress == nullptr) {
+    // Returning to native code.
+    stack_.restore(sp);
+    return result;
+  }
+  // The caller's stack was spilled at the call, so only the result is cached.
+  Frame &caller = callStack_.top();
+  params = caller.params;
+  locals = caller.locals;
+  stackTop = result;
+  instructionPointer = callee.returnAddress;
+  DISPATCH();
+}
+
+PRIMITIVE_CALL:
+  SPILLED(doPrimitiveCall(instructionPointer->immediate));
+  NEXT();
+
+JMP:
+  // Loops are closed by a backward JMP.
+  if (cfg_->tiered && instructionPointer->target <= instructionPointer) {
+    const Frame &frame = callStack_.top();
+    const auto &code = virtualMachine_->getThreadedCode(frame.functionIndex);
+    auto osrFunction = virtualMachine_->countBackEdge(
+        frame.functionIndex, instructionPointer->target - code.code.data());
+    if (osrFunction) {
+      // Lay the operand stack out the way compiled code expects it. The
+      // bottom of the frame's stack holds a placeholder, so shift everything
+      // down over it, and put the cached top back on top.
+      auto nlocals = virtualMachine_->getFunction(frame.functionIndex)->nlocals;
+      StackElement *base = frame.locals + nlocals;
+      if (sp != base) {
+        std::copy(base + 1, sp, base);
+        sp[-1] = stackTop;
+      }
+      stack_.restore(sp);
+      // The compiled code finishes the call, and pops the frame's stack.
+      stackTop = Om::Value(Om::AS_RAW, osrFunction(this, frame.locals));
+      goto FUNCTION_RETURN;
+    }
+  }
+  instructionPointer = instructionPointer->target;
+  DISPATCH();
+
+DUPLICATE:
+  *sp++ = stackTop;
+  NEXT();
+
+DROP:
+  DROP_TOP();
+  NEXT();
+
+PUSH_FROM_LOCAL:
+  PUSH(locals[instructionPointer->immediate]);
+  NEXT();
+
+POP_INTO_LOCAL:
+  locals[instructionPointer->immediate] = stackTop;
+  DROP_TOP();
+  NEXT();
+
+PUSH_FROM_PARAM:
+  PUSH(params[instructionPointer->immediate]);
+  NEXT();
+
+POP_INTO_PARAM:
+  params[instructionPointer->immediate] = stackTop;
+  DROP_TOP();
+  NEXT();
+
+INT_ADD:
+  INT_BINARY_OP(+);
+  NEXT();
+
+INT_SUB:
+  INT_BINARY_OP(-);
+  NEXT();
+
+INT_MUL:
+  INT_BINARY_OP(*);
+  NEXT();
+
+INT_DIV:
+  INT_BINARY_OP(/);
+  NEXT();
+
+INT_PUSH_CONSTANT:
+  PUSH((StackElement{Om::AS_INT48, instructionPointer->immediate}));
+  NEXT();
+
+INT_NOT:
+  assert(stackTop.isInt48());
+  stackTop = StackElement{Om::AS_INT48, !stackTop.getInt48()};
+  NEXT();
+
+JMP_EQ: {
+  auto right = stackTop;
+  auto left = *--sp;
+  DROP_TOP();
+  JUMP_IF(left == right);
+}
+
+JMP_NEQ: {
+  auto right = stackTop;
+  auto left = *--sp;
+  DROP_TOP();
+  JUMP_IF(left != right);
+}
+
+JMP_GT:
+  JUMP_IF_COMPARE(std::greater<>());
+
+JMP_GE:
+  JUMP_IF_COMPARE(std::greater_equal<>());
+
+JMP_LT:
+  JUMP_IF_COMPARE(std::less<>());
+
+JMP_LE:
+  JUMP_IF_COMPARE(std::less_equal<>());
+
+STR_PUSH_CONSTANT:
+  assert(instructionPointer->immediate >= 0);
+  PUSH((StackElement{Om::AS_UINT48,
+                     std::uint64_t(instructionPointer->immediate)}));
+  NEXT();
+
+NEW_OBJECT:
+  SPILLED(doNewObject());
+  NEXT();
+
+PUSH_FROM_OBJECT:
+  SPILLED(doPushFromObject(*instructionPointer->cache));
+  NEXT();
+
+POP_INTO_OBJECT:
+  SPILLED(doPopIntoObject(*instructionPointer->cache));
+  NEXT();
+
+CALL_INDIRECT:
+  SPILLED(doCallIndirect());
+  NEXT();
+
+SYSTEM_COLLECT:
+  SPILLED(doSystemCollect());
+  NEXT();
+
+INT_ADD_LOCAL_LOCAL:
+  PUSH((StackElement{Om::AS_INT48,
+                     locals[instructionPointer[0].immediate].getInt48() +
+                         locals[instructionPointer[1].immediate].getInt48()}));
+  instructionPointer += 3;
+  DISPATCH();
+
+INT_SUB_PARAM_CONSTANT:
+  PUSH((StackElement{Om::AS_INT48,
+                     params[instructionPointer[0].immediate].getInt48() -
+                         instructionPointer[1].immediate}));
+  instructionPointer += 3;
+  DISPATCH();
+
+JMP_EQ_ZERO: {
+  // The jump is the second instruction of the sequence.
+  auto value = stackTop;
+  DROP_TOP();
+  ++instructionPointer;
+  JUMP_IF(value == (StackElement{Om::AS_INT48, 0}));
+}
+
+UNKNOWN:
+  assert(false);
+  NEXT();
+
+END_SECTION:
+  throw std::runtime_error("Reached end of function");
+
+#undef JUMP_IF_COMPARE
+#undef INT_BINARY_OP
+#undef SPILLED
+#undef ENTER_FRAME
+#undef RELOAD
+#undef SPILL
+#undef DROP_TOP
+#undef PUSH
+#undef JUMP_IF
+#undef NEXT
+#undef DISPATCH
+}
+
+#endif  // B9_COMPUTED_GOTO
+
 void ExecutionContext::push(StackElement value) { stack_.push(value); }
 
 StackElement ExecutionContext::pop() { return stack_.pop(); }
@@ -276,6 +909,26 @@ void ExecutionContext::doIntNot() {
   push({Om::AS_INT48, !(x.getInt48())});
 }
 
+bool ExecutionContext::doCompare(OpCode op, StackElement left,
+                                 StackElement right) {
+  switch (op) {
+    case OpCode::JMP_EQ:
+      return left == right;
+    case OpCode::JMP_NEQ:
+      return left != right;
+    case OpCode::JMP_GT:
+      return compare(left, right, std::greater<>());
+    case OpCode::JMP_GE:
+      return compare(left, right, std::greater_equal<>());
+    case OpCode::JMP_LT:
+      return compare(left, right, std::less<>());
+    case OpCode::JMP_LE:
+      return compare(left, right, std::less_equal<>());
+    default:
+      throw std::runtime_error("Not a comparison");
+  }
+}
+
 Immediate ExecutionContext::doJmpEq(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
@@ -294,24 +947,13 @@ Immediate ExecutionContext::doJmpNeq(Immediate delta) {
   return 0;
 }
 
+// ( left right -- )
 Immediate ExecutionContext::doJmpGt(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
-
-  if (right.isInt48() && left.isInt48()) {
-    if (left.getInt48() > right.getInt48()) {
-      return delta;
-    }
-  } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft > strRight) {
-      return delta;
-    }
-  } else {
-    throw std::runtime_error("Operands for comparison not of same type.");
+  if (compare(left, right, std::greater<>())) {
+    return delta;
   }
-
   return 0;
 }
 
@@ -319,21 +961,9 @@ Immediate ExecutionContext::doJmpGt(Immediate delta) {
 Immediate ExecutionContext::doJmpGe(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
-
-  if (right.isInt48() && left.isInt48()) {
-    if (left.getInt48() >= right.getInt48()) {
-      return delta;
-    }
-  } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft >= strRight) {
-      return delta;
-    }
-  } else {
-    throw std::runtime_error("Operands for comparison not of same type.");
+  if (compare(left, right, std::greater_equal<>())) {
+    return delta;
   }
-
   return 0;
 }
 
@@ -341,21 +971,9 @@ Immediate ExecutionContext::doJmpGe(Immediate delta) {
 Immediate ExecutionContext::doJmpLt(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
-
-  if (right.isInt48() && left.isInt48()) {
-    if (left.getInt48() < right.getInt48()) {
-      return delta;
-    }
-  } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft < strRight) {
-      return delta;
-    }
-  } else {
-    throw std::runtime_error("Operands for comparison not of same type.");
+  if (compare(left, right, std::less<>())) {
+    return delta;
   }
-
   return 0;
 }
 
@@ -363,21 +981,9 @@ Immediate ExecutionContext::doJmpLt(Immediate delta) {
 Immediate ExecutionContext::doJmpLe(Immediate delta) {
   auto right = stack_.pop();
   auto left = stack_.pop();
-
-  if (right.isInt48() && left.isInt48()) {
-    if (left.getInt48() <= right.getInt48()) {
-      return delta;
-    }
-  } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft <= strRight) {
-      return delta;
-    }
-  } else {
-    throw std::runtime_error("Operands for comparison not of same type.");
+  if (compare(left, right, std::less_equal<>())) {
+    return delta;
   }
-
   return 0;
 }
 
@@ -440,6 +1046,92 @@ void ExecutionContext::doPopIntoObject(Om::Id slotId) {
   // TODO: Write barrier the object on store.
 }
 
+// ( -- left+right )
+void ExecutionContext::doIntAddLocalLocal(StackElement *locals, Immediate left,
+                                          Immediate right) {
+  push({Om::AS_INT48, locals[left].getInt48() + locals[right].getInt48()});
+}
+
+// ( -- param-constant )
+void ExecutionContext::doIntSubParamConstant(StackElement *params,
+                                             Immediate offset,
+                                             Immediate constant) {
+  push({Om::AS_INT48, params[offset].getInt48() - constant});
+}
+
+// ( value -- )
+Immediate ExecutionContext::doJmpEqZero(Immediate delta) {
+  auto value = stack_.pop();
+  if (value == StackElement{Om::AS_INT48, 0}) {
+    return delta;
+  }
+  return 0;
+}
+
+// ( object -- value )
+void ExecutionContext::doPushFromObject(PropertyCache &cache) {
+  auto value = stack_.pop();
+  if (!value.isRef()) {
+    throw std::runtime_error("Accessing non-object value as an object.");
+  }
+  auto obj = value.getRef<Om::Object>();
+  const void *shape = obj->layout();
+
+  auto entry = cache.lookup(shape);
+  if (entry != nullptr) {
+    stack_.push(Om::getValue(*this, obj, entry->descriptor));
+    return;
+  }
+
+  Om::SlotDescriptor descriptor;
+  auto found = Om::lookupSlot(*this, obj, cache.slotId(), descriptor);
+  if (!found) {
+    throw std::runtime_error("Accessing an object's field that doesn't exist.");
+  }
+  cache.insert(shape, nullptr, descriptor);
+  stack_.push(Om::getValue(*this, obj, descriptor));
+}
+
+// ( value object -- )
+void ExecutionContext::doPopIntoObject(PropertyCache &cache) {
+  if (!stack_.peek().isRef()) {
+    throw std::runtime_error("Accessing non-object as an object");
+  }
+
+  auto object = stack_.pop().getRef<Om::Object>();
+  const void *shape = object->layout();
+  const auto slotId = cache.slotId();
+
+  auto entry = cache.lookup(shape);
+  if (entry != nullptr) {
+    // For a cached transition, every object of this shape that adds the slot
+    // makes the same transition, so the object takes the cached shape
+    // directly, and nothing allocates.
+    if (entry->transition != nullptr) {
+      object->layout(entry->transition);
+    }
+    Om::setValue(*this, object, entry->descriptor, pop());
+    return;
+  }
+
+  static constexpr Om::SlotType type(Om::Id(0), Om::CoreType::VALUE);
+  Om::SlotDescriptor descriptor;
+
+  if (Om::lookupSlot(*this, object, slotId, descriptor)) {
+    cache.insert(shape, nullptr, descriptor);
+  } else {
+    Om::RootRef<Om::Object> root(*this, object);
+    auto map = Om::transitionLayout(*this, root, {{type, slotId}});
+    assert(map != nullptr);
+    object = root.get();
+    Om::lookupSlot(*this, object, slotId, descriptor);
+    cache.insert(shape, object->layout(), descriptor);
+  }
+
+  Om::setValue(*this, object, descriptor, pop());
+  // TODO: Write barrier the object on store.
+}
+
 void ExecutionContext::doCallIndirect() {
   assert(0);  // TODO: Implement call indirect
 }
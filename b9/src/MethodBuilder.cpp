@@ -2,6 +2,7 @@
 #include "b9/ExecutionContext.hpp"
 #include "b9/VirtualMachine.hpp"
 #include "b9/compiler/Compiler.hpp"
+#include "b9/compiler/TypeInference.hpp"
 #include "b9/instructions.hpp"
 
 #include <OMR/Om/ValueBuilder.hpp>
@@ -10,6 +11,8 @@
 #include <ilgen/VirtualMachineRegister.hpp>
 #include <ilgen/VirtualMachineRegisterInStruct.hpp>
 
+#include <algorithm>
+
 extern "C" {
 
 void trace(b9::FunctionDef *function, b9::Instruction *instruction) {
@@ -29,14 +32,61 @@ void print_ptr(void *v) { std::cerr << v << std::endl; }
 
 namespace b9 {
 
+constexpr std::size_t MethodBuilder::NO_OSR_ENTRY;
+constexpr std::size_t MethodBuilder::MAX_INLINE_SIZE;
+constexpr std::size_t MethodBuilder::HOT_INLINE_DEPTH;
+
+/// The conditional jumps that compare two values.
+static bool isCompareJump(OpCode op) {
+  switch (op) {
+    case OpCode::JMP_EQ:
+    case OpCode::JMP_NEQ:
+    case OpCode::JMP_GT:
+    case OpCode::JMP_GE:
+    case OpCode::JMP_LT:
+    case OpCode::JMP_LE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// Warm code is meant to be cheap to compile, and hot code is meant to be fast.
+static std::size_t inlineDepth(const Config &cfg, Tier tier,
+                               std::size_t hotDepth) {
+  switch (tier) {
+    case Tier::WARM:
+      return 0;
+    case Tier::HOT:
+      return std::max(cfg.maxInlineDepth, hotDepth);
+    default:
+      return cfg.maxInlineDepth;
+  }
+}
+
+MethodBuilder::MethodBuilder(VirtualMachine &virtualMachine,
+                             const std::size_t functionIndex, const Tier tier)
+    : MethodBuilder(virtualMachine, functionIndex, NO_OSR_ENTRY, tier) {}
+
 MethodBuilder::MethodBuilder(VirtualMachine &virtualMachine,
-                             const std::size_t functionIndex)
+                             const std::size_t functionIndex,
+                             const std::size_t osrEntry)
+    : MethodBuilder(virtualMachine, functionIndex, osrEntry, Tier::DEFAULT) {}
+
+MethodBuilder::MethodBuilder(VirtualMachine &virtualMachine,
+                             const std::size_t functionIndex,
+                             const std::size_t osrEntry, const Tier tier)
     : TR::MethodBuilder(&virtualMachine.compiler()->typeDictionary()),
       virtualMachine_(virtualMachine),
       cfg_(virtualMachine.config()),
-      maxInlineDepth_(cfg_.maxInlineDepth),
+      maxInlineDepth_(inlineDepth(cfg_, tier, HOT_INLINE_DEPTH)),
       globalTypes_(virtualMachine.compiler()->globalTypes()),
-      functionIndex_(functionIndex) {
+      functionIndex_(functionIndex),
+      osrEntry_(osrEntry),
+      tier_(tier),
+      speculate_(cfg_.speculate &&
+                 virtualMachine.getProfile(functionIndex).deoptimizations ==
+                     0) {
   const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
 
   /// TODO: The __LINE__/__FILE__ stuff is 100% bogus, this is about as bad.
@@ -71,6 +121,13 @@ void MethodBuilder::defineParams() {
   /// first argument is always the execution context
   DefineParameter("executionContext", globalTypes().executionContextPtr);
 
+  /// An OSR entry continues an interpreted frame, which is on the VM stack.
+  if (isOsr()) {
+    assert(!cfg_.passParam);
+    DefineParameter("osrLocals", globalTypes().stackElementPtr);
+    return;
+  }
+
   /// In pass param, arguments are passed using C linkage. Otherwise, parameters
   /// are on the stack.
   if (cfg_.passParam) {
@@ -98,6 +155,16 @@ void MethodBuilder::defineLocals() {
   // Address of the current stack top
   DefineLocal("stackTop", globalTypes().stackElementPtr);
 
+  // Address of the stack top on entry, where this frame's operand stack starts
+  DefineLocal("operandBase", globalTypes().stackElementPtr);
+
+  // Scratch space for object operations
+  DefineLocal("objectShape", Address);
+  DefineLocal("objectValue", globalTypes().stackElement);
+
+  // The result of a late-bound call
+  DefineLocal("callResult", globalTypes().stackElement);
+
   locals_.resize(function->nlocals);
 
   for (std::size_t i = 0; i < function->nlocals; i++) {
@@ -106,19 +173,28 @@ void MethodBuilder::defineLocals() {
   }
 }
 
+/// Functions that are already compiled are called directly. Every other
+/// function is defined without an entry point, so a late-bound call can give
+/// the address at runtime. The method itself is called by name, unless it will
+/// be replaced.
 void MethodBuilder::defineFunctions() {
+  callees_.resize(virtualMachine_.getFunctionCount());
   int functionIndex = 0;
   while (functionIndex < virtualMachine_.getFunctionCount()) {
-    if (virtualMachine_.getJitAddress(functionIndex) != nullptr) {
+    // Read the address once, a background compile may install it meanwhile.
+    JitFunction address = virtualMachine_.getJitAddress(functionIndex);
+    callees_[functionIndex] = address;
+    if (address != nullptr || functionIndex != functionIndex_ ||
+        isReplaceable(functionIndex)) {
       auto function = virtualMachine_.getFunction(functionIndex);
       auto name = function->name.c_str();
-      DefineFunction(name, (char *)__FILE__, name,
-                     (void *)virtualMachine_.getJitAddress(functionIndex),
-                     Int64, function->nparams, globalTypes().stackElement,
-                     globalTypes().stackElement, globalTypes().stackElement,
-                     globalTypes().stackElement, globalTypes().stackElement,
-                     globalTypes().stackElement, globalTypes().stackElement,
-                     globalTypes().stackElement);
+      // Compiled functions take the execution context, and in pass-param
+      // mode, every argument.
+      std::size_t nparams = cfg_.passParam ? function->nparams : 0;
+      std::vector<TR::IlType *> types(nparams + 1, globalTypes().stackElement);
+      types[0] = globalTypes().executionContextPtr;
+      DefineFunction(name, (char *)__FILE__, name, (void *)address, Int64,
+                     types.size(), types.data());
     }
     functionIndex++;
   }
@@ -129,6 +205,35 @@ void MethodBuilder::defineFunctions() {
   DefineFunction((char *)"primitive_call", (char *)__FILE__, "primitive_call",
                  (void *)&primitive_call, NoType, 2,
                  globalTypes().executionContextPtr, Int32);
+  DefineFunction((char *)"new_object", (char *)__FILE__, "new_object",
+                 (void *)&new_object, NoType, 1,
+                 globalTypes().executionContextPtr);
+  DefineFunction((char *)"push_from_object", (char *)__FILE__,
+                 "push_from_object", (void *)&push_from_object, Int64, 3,
+                 globalTypes().executionContextPtr, Address,
+                 globalTypes().stackElement);
+  DefineFunction((char *)"pop_into_object", (char *)__FILE__,
+                 "pop_into_object", (void *)&pop_into_object, NoType, 4,
+                 globalTypes().executionContextPtr, Address,
+                 globalTypes().stackElement, globalTypes().stackElement);
+  DefineFunction((char *)"call_indirect", (char *)__FILE__, "call_indirect",
+                 (void *)&call_indirect, NoType, 1,
+                 globalTypes().executionContextPtr);
+  DefineFunction((char *)"system_collect", (char *)__FILE__, "system_collect",
+                 (void *)&system_collect, NoType, 1,
+                 globalTypes().executionContextPtr);
+  DefineFunction((char *)"compare_values", (char *)__FILE__,
+                 "compare_values", (void *)&compare_values, Int32, 4,
+                 globalTypes().executionContextPtr, Int32,
+                 globalTypes().stackElement, globalTypes().stackElement);
+  DefineFunction((char *)"deoptimize", (char *)__FILE__, "deoptimize",
+                 (void *)&::deoptimize, Int64, 5,
+                 globalTypes().executionContextPtr, globalTypes().size,
+                 globalTypes().size, globalTypes().stackElementPtr,
+                 globalTypes().stackElementPtr);
+  DefineFunction((char *)"recompile_hot", (char *)__FILE__, "recompile_hot",
+                 (void *)&recompile_hot, NoType, 2,
+                 globalTypes().executionContextPtr, globalTypes().size);
   DefineFunction((char *)"trace", (char *)__FILE__, "trace", (void *)&trace,
                  NoType, 2, globalTypes().addressPtr, globalTypes().addressPtr);
   DefineFunction((char *)"print_stack", (char *)__FILE__, "print_stack",
@@ -144,10 +249,7 @@ bool MethodBuilder::inlineProgramIntoBuilder(
     const std::size_t functionIndex, bool isTopLevel,
     TR::BytecodeBuilder *currentBuilder,
     TR::BytecodeBuilder *jumpToBuilderForInlinedReturn) {
-  bool success = true;
-  maxInlineDepth_--;
   const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
-  const Instruction *program = function->instructions.data();
 
   // Create a BytecodeBuilder for each Bytecode
   auto numberOfBytecodes = function->instructions.size();
@@ -164,22 +266,63 @@ bool MethodBuilder::inlineProgramIntoBuilder(
     std::cout << "Creating " << numberOfBytecodes << " bytecode builders"
               << std::endl;
 
+  inlineFrames_.emplace_back();
+  InlineFrame &frame = inlineFrames_.back();
+  frame.functionIndex = functionIndex;
+  frame.base = nextBytecodeIndex_;
+  frame.depth = isTopLevel ? 0 : frame_->depth + 1;
+  frame.caller = isTopLevel ? nullptr : frame_;
+  frame.continuation = jumpToBuilderForInlinedReturn;
+  frame.types.reset(new TypeInference(virtualMachine_, *function));
+  nextBytecodeIndex_ += numberOfBytecodes;
+
   // create the builders
 
-  std::vector<TR::BytecodeBuilder *> builderTable;
-  builderTable.reserve(numberOfBytecodes);
-  for (int i = 0; i < numberOfBytecodes; i++) {
-    builderTable.push_back(OrphanBytecodeBuilder(i));
+  frame.builders.reserve(numberOfBytecodes);
+  for (std::size_t i = 0; i < numberOfBytecodes; i++) {
+    frame.builders.push_back(OrphanBytecodeBuilder(frame.base + i));
   }
 
-  // Get the first Builder
-
-  TR::BytecodeBuilder *builder = builderTable[0];
-
   if (isTopLevel) {
-    AppendBuilder(builder);
+    frame.locals = locals_;
+    frame_ = &frame;
+    if (isOsr()) {
+      loadOsrLocals();
+    }
+    if (tier_ == Tier::WARM) {
+      auto &profile = virtualMachine_.getProfile(functionIndex_);
+      countWarm(this, &profile.warmInvocations);
+    }
+    AppendBuilder(frame.builders[isOsr() ? osrEntry_ : 0]);
   } else {
-    currentBuilder->AddFallThroughBuilder(builder);
+    // Give the callee fresh params and locals. The arguments are popped off
+    // the caller's stack, right-to-left.
+    auto prefix = "inline" + std::to_string(inlineFrames_.size() - 1) + "_";
+    frame.params.resize(function->nparams);
+    for (std::size_t i = 0; i < function->nparams; i++) {
+      frame.params[i] = prefix + PARAM_STRING + std::to_string(i);
+      DefineLocal(frame.params[i].c_str(), globalTypes().stackElement);
+    }
+    frame.locals.resize(function->nlocals);
+    for (std::size_t i = 0; i < function->nlocals; i++) {
+      frame.locals[i] = prefix + LOCAL_STRING + std::to_string(i);
+      DefineLocal(frame.locals[i].c_str(), globalTypes().stackElement);
+    }
+
+    for (std::size_t i = function->nparams; i > 0; i--) {
+      currentBuilder->Store(frame.params[i - 1].c_str(),
+                            popValue(currentBuilder));
+    }
+    // Locals start zeroed, as they do in the interpreter.
+    for (const auto &local : frame.locals) {
+      currentBuilder->Store(
+          local.c_str(),
+          currentBuilder->ConstInteger(globalTypes().stackElement, 0));
+    }
+
+    // The callee's IL is generated from the worklist, with the caller's.
+    currentBuilder->AddFallThroughBuilder(frame.builders[0]);
+    return true;
   }
 
   // Gen IL
@@ -187,13 +330,41 @@ bool MethodBuilder::inlineProgramIntoBuilder(
 
   for (std::size_t index = GetNextBytecodeFromWorklist(); index != -1;
        index = GetNextBytecodeFromWorklist()) {
-    ok = generateILForBytecode(function, builderTable, index,
-                               jumpToBuilderForInlinedReturn);
+    // Find the body the builder belongs to. Bodies are in order of base.
+    auto body = std::upper_bound(
+        inlineFrames_.begin(), inlineFrames_.end(), index,
+        [](std::size_t i, const InlineFrame &f) { return i < f.base; });
+    frame_ = &*--body;
+    auto bodyFunction = virtualMachine_.getFunction(frame_->functionIndex);
+    ok = generateILForBytecode(bodyFunction, frame_->builders,
+                               index - frame_->base, frame_->continuation);
     if (!ok) break;
   }
   return ok;
 }
 
+bool MethodBuilder::shouldInline(std::size_t target) {
+  if (cfg_.debug || frame_->depth >= std::size_t(maxInlineDepth_)) {
+    return false;
+  }
+
+  // Never inline recursively.
+  if (target == functionIndex_) {
+    return false;
+  }
+  for (auto f = frame_; f != nullptr; f = f->caller) {
+    if (f->functionIndex == target) {
+      return false;
+    }
+  }
+
+  const FunctionDef *callee = virtualMachine_.getFunction(target);
+  // An inlined function's returns simply fall through to the caller, so
+  // anything else left on the stack would be left in the caller's frame.
+  return callee->instructions.size() <= MAX_INLINE_SIZE &&
+         TypeInference(virtualMachine_, *callee).hasBalancedReturns();
+}
+
 bool MethodBuilder::buildIL() {
   const FunctionDef *function = virtualMachine_.getFunction(functionIndex_);
 
@@ -203,6 +374,7 @@ bool MethodBuilder::buildIL() {
 
   TR::IlValue *stackTop = LoadIndirect("b9::OperandStack", "top_", stack);
   Store("stackTop", stackTop);
+  Store("operandBase", stackTop);
 
   if (cfg_.lazyVmState) {
     setVMState(new ModelState(this, globalTypes()));
@@ -216,7 +388,13 @@ bool MethodBuilder::buildIL() {
   ///
   /// In the case of pass immediate, the arguments are not passed on the VM
   /// stack. The arguments are passed on the C stack as a part of a cdecl call.
-  if (!cfg_.passParam) {
+  /// An OSR entry picks up the interpreter's frame: the params are below the
+  /// locals, and the locals are copied in. Anything on the operand stack is
+  /// left where it is.
+  if (isOsr()) {
+    Store("stackBase", IndexAt(globalTypes().stackElementPtr, Load("osrLocals"),
+                               ConstInt32(-function->nparams)));
+  } else if (!cfg_.passParam) {
     TR::IlValue *stackBase = IndexAt(globalTypes().stackElementPtr, stackTop,
                                      ConstInt32(-function->nparams));
     Store("stackBase", stackBase);
@@ -227,17 +405,41 @@ bool MethodBuilder::buildIL() {
   return inlineProgramIntoBuilder(functionIndex_, true);
 }
 
+/// The interpreted frame's locals are boxed, like every other value on the
+/// operand stack.
+void MethodBuilder::loadOsrLocals() {
+  const FunctionDef *function = virtualMachine_.getFunction(functionIndex_);
+  TR::IlValue *osrLocals = Load("osrLocals");
+  for (std::size_t i = 0; i < function->nlocals; i++) {
+    TR::IlValue *address =
+        IndexAt(globalTypes().stackElementPtr, osrLocals, ConstInt32(i));
+    storeLocal(this, i, LoadAt(globalTypes().stackElementPtr, address));
+  }
+}
+
+/// A local that only ever holds int48s is kept unboxed. Loading it boxes the
+/// value, but an arithmetic instruction that pops the box gets the raw value
+/// back, and the box is dead.
 TR::IlValue *MethodBuilder::loadLocal(TR::IlBuilder *b, std::size_t index) {
-  return b->Load(locals_[index].c_str());
+  TR::IlValue *value = b->Load(frame_->locals[index].c_str());
+  if (frame_->types->isInt48Local(index)) {
+    return boxInt48(b, value);
+  }
+  return value;
 }
 
 void MethodBuilder::storeLocal(TR::IlBuilder *b, std::size_t index,
                                TR::IlValue *value) {
-  b->Store(locals_[index].c_str(), value);
+  if (frame_->types->isInt48Local(index)) {
+    value = unboxInt48(b, value);
+  }
+  b->Store(frame_->locals[index].c_str(), value);
 }
 
 TR::IlValue *MethodBuilder::loadParam(TR::IlBuilder *b, std::size_t index) {
-  if (cfg_.passParam) {
+  if (frame_ && frame_->depth > 0) {
+    return b->Load(frame_->params[index].c_str());
+  } else if (cfg_.passParam) {
     return b->Load(params_[index].c_str());
   } else {
     TR::IlValue *args = b->Load("stackBase");
@@ -250,7 +452,9 @@ TR::IlValue *MethodBuilder::loadParam(TR::IlBuilder *b, std::size_t index) {
 
 void MethodBuilder::storeParam(TR::IlBuilder *b, std::size_t index,
                                TR::IlValue *value) {
-  if (cfg_.passParam) {
+  if (frame_ && frame_->depth > 0) {
+    b->Store(frame_->params[index].c_str(), value);
+  } else if (cfg_.passParam) {
     b->Store(params_[index].c_str(), value);
   } else {
     TR::IlValue *args = b->Load("stackBase");
@@ -262,7 +466,7 @@ void MethodBuilder::storeParam(TR::IlBuilder *b, std::size_t index,
 
 bool MethodBuilder::generateILForBytecode(
     const FunctionDef *function,
-    std::vector<TR::BytecodeBuilder *> bytecodeBuilderTable,
+    const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
     std::size_t instructionIndex,
     TR::BytecodeBuilder *jumpToBuilderForInlinedReturn) {
   TR::BytecodeBuilder *builder = bytecodeBuilderTable[instructionIndex];
@@ -270,8 +474,21 @@ bool MethodBuilder::generateILForBytecode(
   const Instruction instruction = program[instructionIndex];
 
   if (cfg_.verbose) {
+    // Flushing every line dominates IL generation for large functions.
     std::cout << "generating index=" << instructionIndex
-              << " bc=" << instruction << std::endl;
+              << " bc=" << instruction << '\n';
+  }
+
+  // Where control flow meets, the values in the modelled stack are merged, so
+  // they no longer match the raw values they were boxed from. The same goes
+  // for the returns of an inlined call.
+  if (frame_->types->isMergePoint(instructionIndex) ||
+      (instructionIndex > 0 &&
+       program[instructionIndex - 1].opCode() == OpCode::FUNCTION_CALL)) {
+    // clear() would keep, and walk, the buckets of the largest region so far.
+    if (!unboxedValues_.empty()) {
+      decltype(unboxedValues_)().swap(unboxedValues_);
+    }
   }
 
   if (nullptr == builder) {
@@ -280,9 +497,15 @@ bool MethodBuilder::generateILForBytecode(
     return false;
   }
 
+  // Warm code doesn't inline, so every body is the method's own.
+  if (tier_ == Tier::WARM && frame_->types->isLoopHeader(instructionIndex)) {
+    countWarm(builder,
+              &virtualMachine_.getProfile(functionIndex_).warmBackEdges);
+  }
+
   TR::BytecodeBuilder *nextBytecodeBuilder = nullptr;
 
-  if (instructionIndex + 1 <= program.size()) {
+  if (instructionIndex + 1 < program.size()) {
     nextBytecodeBuilder = bytecodeBuilderTable[instructionIndex + 1];
   }
 
@@ -304,6 +527,13 @@ bool MethodBuilder::generateILForBytecode(
     state(builder)->Commit(builder);
   }
 
+  // With speculation, every comparison is compiled the same way.
+  if (cfg_.speculate && isCompareJump(instruction.opCode())) {
+    handle_bc_jmp_compare(builder, bytecodeBuilderTable, program,
+                          instructionIndex, nextBytecodeBuilder);
+    return true;
+  }
+
   switch (instruction.opCode()) {
     case OpCode::PUSH_FROM_LOCAL:
       pushValue(builder, loadLocal(builder, instruction.immediate()));
@@ -326,6 +556,11 @@ bool MethodBuilder::generateILForBytecode(
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
       break;
     case OpCode::FUNCTION_RETURN: {
+      if (jumpToBuilderForInlinedReturn != nullptr) {
+        // The result is already on top of the caller's stack.
+        builder->AddFallThroughBuilder(jumpToBuilderForInlinedReturn);
+        break;
+      }
       auto result = popValue(builder);
       TR::IlValue *stack = builder->StructFieldInstanceAddress(
           "b9::ExecutionContext", "stack_", builder->Load("executionContext"));
@@ -416,6 +651,43 @@ bool MethodBuilder::generateILForBytecode(
       handle_bc_function_call(builder, nextBytecodeBuilder,
                               instruction.immediate());
     } break;
+    case OpCode::NEW_OBJECT:
+      runtimeCall(builder, "new_object");
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+      break;
+    case OpCode::PUSH_FROM_OBJECT:
+      handle_bc_push_from_object(builder, nextBytecodeBuilder,
+                                 instructionIndex,
+                                 Om::Id(instruction.immediate()));
+      break;
+    case OpCode::POP_INTO_OBJECT:
+      handle_bc_pop_into_object(builder, nextBytecodeBuilder,
+                                instructionIndex,
+                                Om::Id(instruction.immediate()));
+      break;
+    case OpCode::CALL_INDIRECT:
+      runtimeCall(builder, "call_indirect");
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+      break;
+    case OpCode::SYSTEM_COLLECT:
+      runtimeCall(builder, "system_collect");
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+      break;
+    case OpCode::INT_ADD_LOCAL_LOCAL:
+      handle_bc_add_local_local(builder, bytecodeBuilderTable, program,
+                                instructionIndex);
+      break;
+    case OpCode::INT_SUB_PARAM_CONSTANT:
+      handle_bc_sub_param_constant(builder, bytecodeBuilderTable, program,
+                                   instructionIndex);
+      break;
+    case OpCode::JMP_EQ_ZERO:
+      handle_bc_jmp_eq_zero(builder, bytecodeBuilderTable, program,
+                            instructionIndex);
+      break;
     default:
       if (cfg_.debug) {
         std::cout << "Cannot handle unknown bytecode: returning" << std::endl;
@@ -450,11 +722,10 @@ void MethodBuilder::directCall(TR::BytecodeBuilder *b, std::size_t target) {
     std::cout << "directCall: " << callee.name << std::endl;
   }
 
-  assert(virtualMachine_.getJitAddress(target) || target == functionIndex_);
+  assert(callees_[target] || target == functionIndex_);
 
   state(b)->Commit(b);
-  auto result = b->Call(callee.name.c_str(), 2, b->Load("executionContext"),
-                        b->ConstInt64(target));
+  auto result = b->Call(callee.name.c_str(), 1, b->Load("executionContext"));
   state(b)->adjust(b, -callee.nparams);
   state(b)->Reload(b);
   state(b)->pushValue(b, result);
@@ -467,7 +738,7 @@ void MethodBuilder::passParamCall(TR::BytecodeBuilder *b, std::size_t target) {
     std::cout << "passParamCall: " << callee.name << std::endl;
   }
 
-  assert(virtualMachine_.getJitAddress(target) || target == functionIndex_);
+  assert(callees_[target] || target == functionIndex_);
 
   /// Pop the args for passing. Args are pushed left-to-right, so popping is
   /// right-to-left.
@@ -482,20 +753,102 @@ void MethodBuilder::passParamCall(TR::BytecodeBuilder *b, std::size_t target) {
   state(b)->pushValue(b, result);
 }
 
+/// The call checks the callee's entry in the VM's linkage table. Once the
+/// callee is compiled, it's called directly, and until then, through the
+/// interpreter. Everything is committed first, so the interpreter finds the
+/// arguments on the VM stack. Pass-param callees take them in registers too,
+/// and leave the stack alone, so they're popped here.
+void MethodBuilder::lateBoundCall(TR::BytecodeBuilder *b, std::size_t target) {
+  const auto &callee = virtualMachine_.module()->functions[target];
+
+  if (cfg_.verbose) {
+    std::cout << "lateBoundCall: " << callee.name << std::endl;
+  }
+
+  state(b)->Commit(b);
+
+  TR::IlValue *address =
+      b->LoadAt(globalTypes().addressPtr,
+                b->ConstAddress(virtualMachine_.getLinkage(target)));
+
+  TR::IlBuilder *compiled = nullptr;
+  TR::IlBuilder *interpreted = nullptr;
+  b->IfThenElse(&compiled, &interpreted,
+                b->NotEqualTo(address, b->ConstAddress(nullptr)));
+
+  interpreted->Store(
+      "callResult",
+      interpreted->Call("interpret", 2, interpreted->Load("executionContext"),
+                        interpreted->ConstInt64(target)));
+
+  std::vector<TR::IlValue *> args = {address,
+                                     compiled->Load("executionContext")};
+  if (cfg_.passParam) {
+    auto c = compiled;
+    TR::IlValue *stack = c->StructFieldInstanceAddress(
+        "b9::ExecutionContext", "stack_", c->Load("executionContext"));
+    TR::IlValue *top = c->LoadIndirect("b9::OperandStack", "top_", stack);
+    TR::IlValue *base =
+        c->IndexAt(globalTypes().stackElementPtr, top,
+                   c->ConstInt32(-std::int32_t(callee.nparams)));
+    for (std::size_t i = 0; i < callee.nparams; i++) {
+      TR::IlValue *arg =
+          c->IndexAt(globalTypes().stackElementPtr, base, c->ConstInt32(i));
+      args.push_back(c->LoadAt(globalTypes().stackElementPtr, arg));
+    }
+    c->StoreIndirect("b9::OperandStack", "top_", stack, base);
+  }
+  compiled->Store(
+      "callResult",
+      compiled->ComputedCall(callee.name.c_str(), args.size(), args.data()));
+
+  state(b)->adjust(b, -callee.nparams);
+  state(b)->Reload(b);
+  state(b)->pushValue(b, b->Load("callResult"));
+}
+
+void MethodBuilder::runtimeCall(TR::BytecodeBuilder *b, const char *name) {
+  state(b)->Commit(b);
+  b->Call(name, 1, b->Load("executionContext"));
+  state(b)->Reload(b);
+}
+
+void MethodBuilder::loadShape(TR::BytecodeBuilder *b, TR::IlValue *value,
+                              const PropertyCache &cache) {
+  b->Store("objectShape", b->ConstAddress(&cache));
+
+  TR::IlBuilder *isObject = nullptr;
+  b->IfThen(&isObject, OMR::Om::ValueBuilder::isRef(b, value));
+  TR::IlValue *object = OMR::Om::ValueBuilder::getRef(isObject, value);
+  isObject->Store("objectShape",
+                  isObject->LoadIndirect("OMR::Om::Object", "layout_", object));
+}
+
 void MethodBuilder::handle_bc_function_call(TR::BytecodeBuilder *builder,
                                             TR::BytecodeBuilder *nextBuilder,
                                             std::size_t target) {
-  bool interpret = cfg_.debug || (!virtualMachine_.getJitAddress(target) &&
-                                  target != functionIndex_);
+  if (nextBuilder && shouldInline(target)) {
+    if (cfg_.verbose) {
+      std::cout << "inlining: " << virtualMachine_.getFunction(target)->name
+                << std::endl;
+    }
+    inlineProgramIntoBuilder(target, false, builder, nextBuilder);
+    return;
+  }
+
+  // An OSR entry can't call itself, it's not the function's real entry.
+  bool direct = !cfg_.debug && (cfg_.passParam || cfg_.directCall);
+  bool self = target == functionIndex_;
 
-  if (interpret) {
+  if (!direct || (self && isOsr())) {
     interpreterCall(builder, target);
+  } else if (isReplaceable(target) ||
+             (!self && callees_[target] == nullptr)) {
+    lateBoundCall(builder, target);
   } else if (cfg_.passParam) {
     passParamCall(builder, target);
-  } else if (cfg_.directCall) {
-    directCall(builder, target);
   } else {
-    interpreterCall(builder, target);
+    directCall(builder, target);
   }
 
   if (nextBuilder) builder->AddFallThroughBuilder(nextBuilder);
@@ -505,6 +858,91 @@ void MethodBuilder::handle_bc_function_call(TR::BytecodeBuilder *builder,
  * GENERATE CODE FOR BYTECODES
  *************************************************/
 
+/// An object access checks the shape of the object against the primary entry
+/// of the site's PropertyCache, and on a match, accesses the slot directly at
+/// the cached offset. Anything else, including a store that adds the slot,
+/// goes through the runtime, which fills the cache.
+///
+/// The stack is committed first, so the slow path sees every live value.
+
+void MethodBuilder::handle_bc_push_from_object(TR::BytecodeBuilder *builder,
+                                               TR::BytecodeBuilder *nextBuilder,
+                                               std::size_t bytecodeIndex,
+                                               Om::Id slotId) {
+  PropertyCache &cache = virtualMachine_.getJitPropertyCache(
+      frame_->functionIndex, bytecodeIndex, slotId);
+  const PropertyCache::Entry &primary = cache.primary();
+
+  state(builder)->Commit(builder);
+  TR::IlValue *value = popValue(builder);
+  loadShape(builder, value, cache);
+
+  TR::IlValue *cachedShape =
+      builder->LoadAt(globalTypes().addressPtr,
+                      builder->ConstAddress(&primary.shape));
+
+  TR::IlBuilder *hit = nullptr;
+  TR::IlBuilder *miss = nullptr;
+  builder->IfThenElse(&hit, &miss,
+                      builder->EqualTo(builder->Load("objectShape"),
+                                       cachedShape));
+
+  TR::IlValue *offset =
+      hit->LoadAt(globalTypes().int64Ptr, hit->ConstAddress(&primary.offset));
+  TR::IlValue *slot =
+      hit->Add(OMR::Om::ValueBuilder::getRef(hit, value), offset);
+  hit->Store("objectValue", hit->LoadAt(globalTypes().stackElementPtr, slot));
+
+  miss->Store("objectValue",
+              miss->Call("push_from_object", 3, miss->Load("executionContext"),
+                         miss->ConstAddress(&cache), value));
+
+  pushValue(builder, builder->Load("objectValue"));
+  if (nextBuilder) builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_pop_into_object(TR::BytecodeBuilder *builder,
+                                              TR::BytecodeBuilder *nextBuilder,
+                                              std::size_t bytecodeIndex,
+                                              Om::Id slotId) {
+  PropertyCache &cache = virtualMachine_.getJitPropertyCache(
+      frame_->functionIndex, bytecodeIndex, slotId);
+  const PropertyCache::Entry &primary = cache.primary();
+
+  state(builder)->Commit(builder);
+  TR::IlValue *object = popValue(builder);
+  TR::IlValue *value = popValue(builder);
+  loadShape(builder, object, cache);
+
+  TR::IlValue *cachedShape =
+      builder->LoadAt(globalTypes().addressPtr,
+                      builder->ConstAddress(&primary.shape));
+  TR::IlValue *cachedTransition =
+      builder->LoadAt(globalTypes().addressPtr,
+                      builder->ConstAddress(&primary.transition));
+
+  // A transition entry can't be stored to directly, the object must change
+  // shape first.
+  TR::IlValue *isHit = builder->And(
+      builder->EqualTo(builder->Load("objectShape"), cachedShape),
+      builder->EqualTo(cachedTransition, builder->ConstAddress(nullptr)));
+
+  TR::IlBuilder *hit = nullptr;
+  TR::IlBuilder *miss = nullptr;
+  builder->IfThenElse(&hit, &miss, isHit);
+
+  TR::IlValue *offset =
+      hit->LoadAt(globalTypes().int64Ptr, hit->ConstAddress(&primary.offset));
+  TR::IlValue *slot =
+      hit->Add(OMR::Om::ValueBuilder::getRef(hit, object), offset);
+  hit->StoreAt(slot, value);
+
+  miss->Call("pop_into_object", 4, miss->Load("executionContext"),
+             miss->ConstAddress(&cache), object, value);
+
+  if (nextBuilder) builder->AddFallThroughBuilder(nextBuilder);
+}
+
 void MethodBuilder::handle_bc_jmp(
     TR::BytecodeBuilder *builder,
     const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
@@ -517,6 +955,60 @@ void MethodBuilder::handle_bc_jmp(
   builder->Goto(destBuilder);
 }
 
+/// With speculation, comparisons are compiled for int48s only, behind a guard.
+/// The first time a guard fails, the function deoptimizes, and is recompiled
+/// to compare through the runtime, which handles strings as well. Inlined
+/// bodies can't deoptimize, so they always compare through the runtime.
+void MethodBuilder::handle_bc_jmp_compare(
+    TR::BytecodeBuilder *builder,
+    const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+    const std::vector<Instruction> &program, long bytecodeIndex,
+    TR::BytecodeBuilder *nextBuilder) {
+  Instruction instruction = program[bytecodeIndex];
+  int delta = instruction.immediate() + 1;
+  TR::BytecodeBuilder *jumpTo = bytecodeBuilderTable[bytecodeIndex + delta];
+
+  TR::IlValue *right = popValue(builder);
+  TR::IlValue *left = popValue(builder);
+
+  if (!canSpeculate()) {
+    TR::IlValue *taken = builder->Call(
+        "compare_values", 4, builder->Load("executionContext"),
+        builder->ConstInt32(int(instruction.opCode())), left, right);
+    builder->IfCmpNotEqualZero(jumpTo, taken);
+    builder->AddFallThroughBuilder(nextBuilder);
+    return;
+  }
+
+  guardInt48(builder, bytecodeIndex, {left, right});
+  left = unboxInt48(builder, left);
+  right = unboxInt48(builder, right);
+
+  switch (instruction.opCode()) {
+    case OpCode::JMP_EQ:
+      builder->IfCmpEqual(jumpTo, left, right);
+      break;
+    case OpCode::JMP_NEQ:
+      builder->IfCmpNotEqual(jumpTo, left, right);
+      break;
+    case OpCode::JMP_GT:
+      builder->IfCmpGreaterThan(jumpTo, left, right);
+      break;
+    case OpCode::JMP_GE:
+      builder->IfCmpGreaterOrEqual(jumpTo, left, right);
+      break;
+    case OpCode::JMP_LT:
+      builder->IfCmpLessThan(jumpTo, left, right);
+      break;
+    case OpCode::JMP_LE:
+      builder->IfCmpLessOrEqual(jumpTo, left, right);
+      break;
+    default:
+      assert(false);
+  }
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
 void MethodBuilder::handle_bc_jmp_eq(
     TR::BytecodeBuilder *builder,
     const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
@@ -665,6 +1157,171 @@ void MethodBuilder::handle_bc_not(TR::BytecodeBuilder *builder,
   builder->AddFallThroughBuilder(nextBuilder);
 }
 
+/*************************************************
+ * GENERATE CODE FOR SUPERINSTRUCTIONS
+ *
+ * A superinstruction replaces the first instruction of the sequence it fuses.
+ * The remaining instructions are still in the program, and hold the rest of
+ * the sequence's immediates. The builders of the remaining instructions are
+ * only generated if something else jumps to them.
+ *************************************************/
+
+void MethodBuilder::handle_bc_add_local_local(
+    TR::BytecodeBuilder *builder,
+    const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+    const std::vector<Instruction> &program, long bytecodeIndex) {
+  auto leftIndex = program[bytecodeIndex].immediate();
+  auto rightIndex = program[bytecodeIndex + 1].immediate();
+
+  TR::IlValue *left = unboxInt48(builder, loadLocal(builder, leftIndex));
+  TR::IlValue *right = unboxInt48(builder, loadLocal(builder, rightIndex));
+
+  pushInt48(builder, builder->Add(left, right));
+  builder->AddFallThroughBuilder(bytecodeBuilderTable[bytecodeIndex + 3]);
+}
+
+void MethodBuilder::handle_bc_sub_param_constant(
+    TR::BytecodeBuilder *builder,
+    const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+    const std::vector<Instruction> &program, long bytecodeIndex) {
+  auto paramIndex = program[bytecodeIndex].immediate();
+  auto constant = program[bytecodeIndex + 1].immediate();
+
+  TR::IlValue *left =
+      OMR::Om::ValueBuilder::getInt48(builder, loadParam(builder, paramIndex));
+  TR::IlValue *right = builder->ConstInt64(constant);
+
+  pushInt48(builder, builder->Sub(left, right));
+  builder->AddFallThroughBuilder(bytecodeBuilderTable[bytecodeIndex + 3]);
+}
+
+void MethodBuilder::handle_bc_jmp_eq_zero(
+    TR::BytecodeBuilder *builder,
+    const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+    const std::vector<Instruction> &program, long bytecodeIndex) {
+  // The jump is the second instruction of the sequence.
+  long jumpIndex = bytecodeIndex + 1;
+  int delta = program[jumpIndex].immediate() + 1;
+  TR::BytecodeBuilder *jumpTo = bytecodeBuilderTable[jumpIndex + delta];
+
+  TR::IlValue *value = popValue(builder);
+
+  if (cfg_.speculate && !canSpeculate()) {
+    TR::IlValue *zero = boxInt48(builder, builder->ConstInt64(0));
+    TR::IlValue *taken = builder->Call(
+        "compare_values", 4, builder->Load("executionContext"),
+        builder->ConstInt32(int(OpCode::JMP_EQ)), value, zero);
+    builder->IfCmpNotEqualZero(jumpTo, taken);
+  } else {
+    if (cfg_.speculate) {
+      guardInt48(builder, bytecodeIndex, {value});
+    }
+    builder->IfCmpEqual(jumpTo, unboxInt48(builder, value),
+                        builder->ConstInt64(0));
+  }
+  builder->AddFallThroughBuilder(bytecodeBuilderTable[bytecodeIndex + 2]);
+}
+
+/*************************************************
+ * SPECULATION
+ *************************************************/
+
+bool MethodBuilder::canSpeculate() const {
+  return speculate_ && frame_->depth == 0;
+}
+
+/// Values that were boxed here, or that type inference proved, need no check.
+void MethodBuilder::guardInt48(TR::BytecodeBuilder *builder,
+                               std::size_t bytecodeIndex,
+                               const std::vector<TR::IlValue *> &operands) {
+  // The operands were the top of the stack before the instruction.
+  const auto &types = frame_->types->stackTypes(bytecodeIndex);
+  const bool typed = types.size() >= operands.size();
+
+  TR::IlValue *isInt48 = nullptr;
+  for (std::size_t i = 0; i < operands.size(); i++) {
+    if ((typed && types[types.size() - operands.size() + i] ==
+                      ValueType::INT48) ||
+        unboxedValues_.count(operands[i]) != 0) {
+      continue;
+    }
+    TR::IlValue *check = OMR::Om::ValueBuilder::isInt48(builder, operands[i]);
+    isInt48 = isInt48 ? builder->And(isInt48, check) : check;
+  }
+
+  if (isInt48 == nullptr) {
+    return;
+  }
+
+  TR::IlBuilder *pass = nullptr;
+  TR::IlBuilder *fail = nullptr;
+  builder->IfThenElse(&pass, &fail, isInt48);
+  deoptimize(builder, fail, bytecodeIndex, operands);
+}
+
+/// Rebuild the stack as the interpreter would have it just before the
+/// instruction, then push the params and locals, and hand the frame over.
+void MethodBuilder::deoptimize(TR::BytecodeBuilder *builder, TR::IlBuilder *b,
+                               std::size_t bytecodeIndex,
+                               const std::vector<TR::IlValue *> &operands) {
+  const FunctionDef *function = virtualMachine_.getFunction(functionIndex_);
+
+  state(builder)->Commit(b);
+  for (auto operand : operands) {
+    pushToStack(b, operand);
+  }
+  for (std::size_t i = 0; i < function->nparams; i++) {
+    pushToStack(b, loadParam(b, i));
+  }
+  for (std::size_t i = 0; i < function->nlocals; i++) {
+    pushToStack(b, loadLocal(b, i));
+  }
+
+  b->Return(b->Call("deoptimize", 5, b->Load("executionContext"),
+                    b->ConstInt64(functionIndex_),
+                    b->ConstInt64(bytecodeIndex), b->Load("stackBase"),
+                    b->Load("operandBase")));
+}
+
+void MethodBuilder::pushToStack(TR::IlBuilder *b, TR::IlValue *value) {
+  TR::IlValue *stack = b->StructFieldInstanceAddress(
+      "b9::ExecutionContext", "stack_", b->Load("executionContext"));
+  TR::IlValue *top = b->LoadIndirect("b9::OperandStack", "top_", stack);
+  b->StoreAt(top, value);
+  b->StoreIndirect(
+      "b9::OperandStack", "top_", stack,
+      b->IndexAt(globalTypes().stackElementPtr, top, b->ConstInt32(1)));
+}
+
+bool MethodBuilder::isReplaceable(std::size_t functionIndex) {
+  return cfg_.multiTier && !virtualMachine_.getProfile(functionIndex).optimized;
+}
+
+void MethodBuilder::countWarm(TR::IlBuilder *b, std::uint64_t *counter) {
+  auto &profile = virtualMachine_.getProfile(functionIndex_);
+  TR::IlValue *address = b->ConstAddress(counter);
+  b->StoreAt(address, b->Add(b->LoadAt(globalTypes().int64Ptr, address),
+                             b->ConstInt64(1)));
+
+  // The count may already be past the threshold, if a deoptimization
+  // recompiled warm code first. The optimized flag makes the call once.
+  TR::IlValue *count = b->Add(
+      b->LoadAt(globalTypes().int64Ptr,
+                b->ConstAddress(&profile.warmInvocations)),
+      b->LoadAt(globalTypes().int64Ptr,
+                b->ConstAddress(&profile.warmBackEdges)));
+  static_assert(sizeof(profile.optimized) == 1, "Loaded as an Int8");
+  TR::IlValue *optimized = b->LoadAt(globalTypes().int8Ptr,
+                                     b->ConstAddress(&profile.optimized));
+  TR::IlBuilder *hot = nullptr;
+  b->IfThen(&hot,
+            b->And(b->GreaterOrEqualTo(count,
+                                       b->ConstInt64(cfg_.hotThreshold)),
+                   b->EqualTo(optimized, b->ConstInt8(0))));
+  hot->Call("recompile_hot", 2, hot->Load("executionContext"),
+            hot->ConstInt64(functionIndex_));
+}
+
 void MethodBuilder::drop(TR::BytecodeBuilder *builder, std::size_t n) {
   for (std::size_t i = 0; i < n; i++) popValue(builder);
 }
@@ -684,11 +1341,26 @@ TR::IlValue *MethodBuilder::popValue(TR::BytecodeBuilder *b) {
 /// input is an unboxed int48.
 void MethodBuilder::pushInt48(TR::BytecodeBuilder *builder,
                               TR::IlValue *value) {
-  pushValue(builder, OMR::Om::ValueBuilder::fromInt48(builder, value));
+  pushValue(builder, boxInt48(builder, value));
 }
 
 TR::IlValue *MethodBuilder::popInt48(TR::BytecodeBuilder *builder) {
-  return OMR::Om::ValueBuilder::getInt48(builder, popValue(builder));
+  return unboxInt48(builder, popValue(builder));
+}
+
+/// Remember the raw value behind every box, so unboxing it again is free.
+TR::IlValue *MethodBuilder::boxInt48(TR::IlBuilder *b, TR::IlValue *value) {
+  TR::IlValue *boxed = OMR::Om::ValueBuilder::fromInt48(b, value);
+  unboxedValues_[boxed] = value;
+  return boxed;
+}
+
+TR::IlValue *MethodBuilder::unboxInt48(TR::IlBuilder *b, TR::IlValue *value) {
+  auto raw = unboxedValues_.find(value);
+  if (raw != unboxedValues_.end()) {
+    return raw->second;
+  }
+  return OMR::Om::ValueBuilder::getInt48(b, value);
 }
 
 void MethodBuilder::pushUint48(TR::BytecodeBuilder *builder,
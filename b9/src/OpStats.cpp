@@ -0,0 +1,162 @@
+#include <b9/OpStats.hpp>
+
+#include <algorithm>
+#include <iomanip>
+
+namespace b9 {
+
+constexpr std::size_t OpStats::OPCODES;
+constexpr std::size_t OpStats::Frame::NONE;
+
+/// The most rows printed in the pair and instruction tables.
+static constexpr std::size_t TABLE_ROWS = 20;
+
+OpStats::OpStats()
+    : counts_(OPCODES, 0), cycles_(OPCODES, 0), pairs_(OPCODES * OPCODES, 0) {}
+
+std::uint64_t OpStats::siteCount(std::size_t functionIndex,
+                                 std::size_t bytecodeIndex) const {
+  if (functionIndex >= sites_.size() ||
+      bytecodeIndex >= sites_[functionIndex].size()) {
+    return 0;
+  }
+  return sites_[functionIndex][bytecodeIndex];
+}
+
+std::vector<OpCode> OpStats::sortedOpCodes() const {
+  std::vector<OpCode> ops;
+  for (std::size_t i = 0; i < OPCODES; i++) {
+    if (counts_[i] != 0) ops.push_back(OpCode(i));
+  }
+  std::stable_sort(ops.begin(), ops.end(), [this](OpCode a, OpCode b) {
+    return count(a) > count(b);
+  });
+  return ops;
+}
+
+std::vector<OpStats::Pair> OpStats::sortedPairs() const {
+  std::vector<Pair> pairs;
+  for (std::size_t i = 0; i < pairs_.size(); i++) {
+    if (pairs_[i] != 0) {
+      pairs.push_back({OpCode(i / OPCODES), OpCode(i % OPCODES), pairs_[i]});
+    }
+  }
+  std::stable_sort(pairs.begin(), pairs.end(),
+                   [](const Pair &a, const Pair &b) {
+                     return a.count > b.count;
+                   });
+  return pairs;
+}
+
+std::vector<OpStats::Site> OpStats::sortedSites() const {
+  std::vector<Site> sites;
+  for (std::size_t f = 0; f < sites_.size(); f++) {
+    for (std::size_t i = 0; i < sites_[f].size(); i++) {
+      if (sites_[f][i] != 0) sites.push_back({f, i, sites_[f][i]});
+    }
+  }
+  std::stable_sort(sites.begin(), sites.end(),
+                   [](const Site &a, const Site &b) {
+                     return a.count > b.count;
+                   });
+  return sites;
+}
+
+void OpStats::print(std::ostream &out, const Module &module) const {
+  auto flags = out.flags();
+  auto precision = out.precision();
+  std::uint64_t total = 0;
+  for (auto count : counts_) total += count;
+
+  out << std::left << std::setw(24) << "Opcode" << std::right << std::setw(14)
+      << "Count" << std::setw(8) << "%" << std::setw(16) << "Cycles"
+      << std::setw(12) << "Cycles/op" << std::endl;
+  for (auto op : sortedOpCodes()) {
+    out << std::left << std::setw(24) << toString(op) << std::right
+        << std::setw(14) << count(op) << std::setw(8) << std::fixed
+        << std::setprecision(2) << 100.0 * count(op) / total << std::setw(16)
+        << cycles(op) << std::setw(12) << std::setprecision(1)
+        << double(cycles(op)) / count(op) << std::endl;
+  }
+
+  out << std::endl
+      << std::left << std::setw(48) << "Opcode pair" << std::right
+      << std::setw(14) << "Count" << std::endl;
+  auto pairs = sortedPairs();
+  pairs.resize(std::min(pairs.size(), TABLE_ROWS));
+  for (const auto &pair : pairs) {
+    std::string name = std::string(toString(pair.first)) + " -> " +
+                       toString(pair.second);
+    out << std::left << std::setw(48) << name << std::right << std::setw(14)
+        << pair.count << std::endl;
+  }
+
+  out << std::endl
+      << std::left << std::setw(48) << "Instruction" << std::right
+      << std::setw(14) << "Count" << std::endl;
+  auto sites = sortedSites();
+  sites.resize(std::min(sites.size(), TABLE_ROWS));
+  for (const auto &site : sites) {
+    const auto &function = module.functions[site.functionIndex];
+    std::string name = function.name + "@" +
+                       std::to_string(site.bytecodeIndex) + " " +
+                       toString(function.instructions[site.bytecodeIndex]
+                                    .opCode());
+    out << std::left << std::setw(48) << name << std::right << std::setw(14)
+        << site.count << std::endl;
+  }
+
+  out.flags(flags);
+  out.precision(precision);
+}
+
+/// Write a string as a JSON string literal.
+static void printJsonString(std::ostream &out, const std::string &string) {
+  out << '"';
+  for (char c : string) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c)
+          << std::dec << std::setfill(' ');
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+void OpStats::printJson(std::ostream &out, const Module &module) const {
+  out << "{\n  \"opcodes\": [";
+  const char *separator = "\n";
+  for (auto op : sortedOpCodes()) {
+    out << separator << "    {\"opcode\": \"" << toString(op)
+        << "\", \"count\": " << count(op) << ", \"cycles\": " << cycles(op)
+        << "}";
+    separator = ",\n";
+  }
+
+  out << "\n  ],\n  \"pairs\": [";
+  separator = "\n";
+  for (const auto &pair : sortedPairs()) {
+    out << separator << "    {\"first\": \"" << toString(pair.first)
+        << "\", \"second\": \"" << toString(pair.second)
+        << "\", \"count\": " << pair.count << "}";
+    separator = ",\n";
+  }
+
+  out << "\n  ],\n  \"instructions\": [";
+  separator = "\n";
+  for (const auto &site : sortedSites()) {
+    const auto &function = module.functions[site.functionIndex];
+    out << separator << "    {\"function\": ";
+    printJsonString(out, function.name);
+    out << ", \"index\": " << site.bytecodeIndex << ", \"opcode\": \""
+        << toString(function.instructions[site.bytecodeIndex].opCode())
+        << "\", \"count\": " << site.count << "}";
+    separator = ",\n";
+  }
+  out << "\n  ]\n}" << std::endl;
+}
+
+}  // namespace b9
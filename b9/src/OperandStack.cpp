@@ -0,0 +1,133 @@
+#include <b9/OperandStack.hpp>
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+namespace b9 {
+
+namespace {
+
+/// The guard pages of every live OperandStack. The SIGSEGV handler reads this
+/// table, so it's a fixed array of atomics, rather than a container.
+constexpr std::size_t MAX_GUARDS = 256;
+
+std::atomic<std::uintptr_t> guardPages[MAX_GUARDS];
+
+std::size_t pageSize() {
+  static const std::size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+struct sigaction previousAction;
+
+bool isGuardPage(std::uintptr_t address) {
+  const std::uintptr_t page = address & ~(pageSize() - 1);
+  if (page == 0) {
+    return false;  // Empty slots in the table are zero.
+  }
+  for (auto &guard : guardPages) {
+    if (guard.load(std::memory_order_relaxed) == page) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void handleSegv(int signal, siginfo_t *info, void *context) {
+  if (isGuardPage(reinterpret_cast<std::uintptr_t>(info->si_addr))) {
+    static const char message[] = "b9: operand stack overflow\n";
+    auto ignored = write(STDERR_FILENO, message, sizeof(message) - 1);
+    (void)ignored;
+    _exit(EXIT_FAILURE);
+  }
+
+  // Not ours. Defer to the previous handler.
+  if (previousAction.sa_flags & SA_SIGINFO) {
+    previousAction.sa_sigaction(signal, info, context);
+  } else if (previousAction.sa_handler != SIG_DFL &&
+             previousAction.sa_handler != SIG_IGN) {
+    previousAction.sa_handler(signal);
+  } else {
+    // Re-raise with the default action when the handler returns.
+    ::signal(signal, SIG_DFL);
+  }
+}
+
+void installSegvHandler() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = handleSegv;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previousAction);
+  });
+}
+
+void registerGuardPage(void *page) {
+  std::uintptr_t expected = 0;
+  for (auto &guard : guardPages) {
+    if (guard.compare_exchange_strong(expected,
+                                      reinterpret_cast<std::uintptr_t>(page))) {
+      return;
+    }
+    expected = 0;
+  }
+  // The table is full. The guard page still stops the overflow, but it will
+  // be reported as a plain segmentation fault.
+}
+
+void unregisterGuardPage(void *page) {
+  auto expected = reinterpret_cast<std::uintptr_t>(page);
+  for (auto &guard : guardPages) {
+    if (guard.compare_exchange_strong(expected, 0)) {
+      return;
+    }
+    expected = reinterpret_cast<std::uintptr_t>(page);
+  }
+}
+
+}  // namespace
+
+OperandStack::OperandStack(std::size_t size) {
+  installSegvHandler();
+
+  const std::size_t page = pageSize();
+  const std::size_t bytes =
+      (size * sizeof(StackElement) + page - 1) & ~(page - 1);
+
+  mappingSize_ = bytes + page;
+  mapping_ = mmap(nullptr, mappingSize_, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapping_ == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+
+  char *guard = static_cast<char *>(mapping_) + bytes;
+  if (mprotect(guard, page, PROT_NONE) != 0) {
+    munmap(mapping_, mappingSize_);
+    throw std::runtime_error("Failed to protect the operand stack guard page");
+  }
+  registerGuardPage(guard);
+
+  stack_ = static_cast<StackElement *>(mapping_);
+  top_ = stack_;
+  capacity_ = bytes / sizeof(StackElement);
+}
+
+OperandStack::~OperandStack() noexcept {
+  unregisterGuardPage(static_cast<char *>(mapping_) + mappingSize_ -
+                      pageSize());
+  munmap(mapping_, mappingSize_);
+}
+
+}  // namespace b9
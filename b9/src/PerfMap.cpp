@@ -0,0 +1,51 @@
+#include "b9/compiler/PerfMap.hpp"
+
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+namespace b9 {
+
+constexpr std::size_t PerfMap::DEFAULT_SIZE;
+
+PerfMap::PerfMap()
+    : path_("/tmp/perf-" + std::to_string(getpid()) + ".map"),
+      out_(path_, std::ios_base::out | std::ios_base::trunc) {
+  if (!out_) {
+    std::cerr << "Warning: Failed to write perf map: " << path_ << std::endl;
+  }
+  out_ << std::hex;
+}
+
+void PerfMap::add(const void *start, const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto address = reinterpret_cast<std::uintptr_t>(start);
+
+  auto next = bodies_.upper_bound(address);
+  std::size_t size = DEFAULT_SIZE;
+  if (next != bodies_.end()) {
+    size = std::min<std::size_t>(next->first - address, size);
+  }
+
+  if (next != bodies_.begin()) {
+    auto previous = std::prev(next);
+    if (previous->first != address &&
+        address - previous->first < previous->second.size) {
+      previous->second.size = address - previous->first;
+      append(previous->first, previous->second);
+    }
+  }
+
+  Body &body = bodies_[address];
+  body = {size, name};
+  append(address, body);
+}
+
+void PerfMap::append(std::uintptr_t start, const Body &body) {
+  // Flushed a line at a time, so the map is complete however the process
+  // exits.
+  out_ << start << " " << body.size << " " << body.name << std::endl;
+}
+
+}  // namespace b9
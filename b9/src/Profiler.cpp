@@ -0,0 +1,169 @@
+#include <b9/Profiler.hpp>
+
+#include <b9/VirtualMachine.hpp>
+#include <b9/compiler/Compiler.hpp>
+
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+namespace b9 {
+
+constexpr std::size_t Profiler::DEFAULT_INTERVAL;
+constexpr std::size_t Profiler::MAX_DEPTH;
+constexpr std::size_t Profiler::BUFFER_SIZE;
+constexpr std::size_t Profiler::HEADER_SIZE;
+constexpr std::uintptr_t Profiler::COMPILED;
+
+/// The running profiler, if any.
+static std::atomic<Profiler *> activeProfiler{nullptr};
+
+/// The pc a signal interrupted, or 0 where we don't know how to find it.
+static std::uintptr_t interruptedPc(void *context) {
+  auto ucontext = static_cast<ucontext_t *>(context);
+#if defined(__x86_64__)
+  return ucontext->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+  return ucontext->uc_mcontext.pc;
+#else
+  (void)ucontext;
+  return 0;
+#endif
+}
+
+static void handleProfilingSignal(int, siginfo_t *, void *context) {
+  Profiler *profiler = activeProfiler.load(std::memory_order_relaxed);
+  if (profiler) {
+    profiler->sample(interruptedPc(context));
+  }
+}
+
+Profiler::Profiler(std::size_t interval)
+    : interval_(interval), buffer_(BUFFER_SIZE) {}
+
+void Profiler::start(const std::atomic<const ShadowFrame *> &top) {
+  Profiler *expected = nullptr;
+  if (!activeProfiler.compare_exchange_strong(expected, this)) {
+    throw std::runtime_error{"Another profiler is already running"};
+  }
+  top_ = &top;
+  thread_ = pthread_self();
+
+  // The handler stays installed after the profiler stops, so a late SIGPROF
+  // is ignored, rather than killing the process.
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_sigaction = handleProfilingSignal;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, nullptr);
+
+  struct itimerval timer;
+  timer.it_interval.tv_sec = interval_ / 1000000;
+  timer.it_interval.tv_usec = interval_ % 1000000;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+void Profiler::stop() noexcept {
+  if (activeProfiler.load() != this) {
+    return;
+  }
+  struct itimerval timer;
+  std::memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  activeProfiler.store(nullptr);
+}
+
+void Profiler::sample(std::uintptr_t pc) {
+  if (!pthread_equal(pthread_self(), thread_)) {
+    otherThreads_++;
+    return;
+  }
+
+  std::size_t depth = 0;
+  const ShadowFrame *frame = top_->load(std::memory_order_relaxed);
+  for (; frame != nullptr && depth < MAX_DEPTH; frame = frame->caller()) {
+    depth++;
+  }
+
+  std::size_t size = HEADER_SIZE + 2 * depth;
+  if (used_ + size > buffer_.size()) {
+    dropped_++;
+    return;
+  }
+
+  // Frames are recorded innermost first.
+  std::uintptr_t *out = &buffer_[used_];
+  *out++ = depth;
+  *out++ = frame != nullptr;
+  *out++ = pc;
+  frame = top_->load(std::memory_order_relaxed);
+  for (std::size_t i = 0; i < depth; i++, frame = frame->caller()) {
+    *out++ = frame->functionIndex();
+    *out++ = frame->compiled() ? COMPILED : frame->bytecodeIndex();
+  }
+  used_ += size;
+  samples_++;
+}
+
+/// Add a frame to the end of a folded stack.
+static void appendFrame(std::string &stack, const std::string &frame) {
+  if (!stack.empty()) {
+    stack += ';';
+  }
+  stack += frame;
+}
+
+void Profiler::write(std::ostream &out, VirtualMachine &virtualMachine) const {
+  auto compiler = virtualMachine.compiler();
+  std::map<std::string, std::size_t> stacks;
+
+  for (std::size_t i = 0; i < used_;) {
+    const std::size_t depth = buffer_[i];
+    const bool truncated = buffer_[i + 1];
+    const std::uintptr_t pc = buffer_[i + 2];
+    const std::uintptr_t *frames = &buffer_[i + HEADER_SIZE];
+    i += HEADER_SIZE + 2 * depth;
+
+    std::string stack = truncated ? "[truncated]" : "";
+    for (std::size_t f = depth; f-- > 0;) {
+      auto function = virtualMachine.getFunction(frames[2 * f]);
+      const std::uintptr_t bytecodeIndex = frames[2 * f + 1];
+      if (bytecodeIndex == COMPILED) {
+        appendFrame(stack, function->name + " [compiled]");
+        continue;
+      }
+      appendFrame(stack, function->name);
+      if (f == 0) {
+        OpCode op = function->instructions[bytecodeIndex].opCode();
+        appendFrame(stack, function->name + "@" +
+                               std::to_string(bytecodeIndex) + " " +
+                               toString(op));
+      }
+    }
+
+    std::string code = compiler ? compiler->findCode(pc) : "";
+    if (!code.empty()) {
+      appendFrame(stack, "jit:" + code);
+    }
+    if (stack.empty()) {
+      stack = "[native]";
+    }
+    stacks[stack]++;
+  }
+
+  if (otherThreads_ != 0) {
+    stacks["[other thread]"] += otherThreads_;
+  }
+
+  for (const auto &stack : stacks) {
+    out << stack.first << " " << stack.second << "\n";
+  }
+}
+
+}  // namespace b9
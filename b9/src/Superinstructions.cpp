@@ -0,0 +1,77 @@
+#include <b9/Superinstructions.hpp>
+
+#include <initializer_list>
+#include <vector>
+
+namespace b9 {
+
+/// Match the opcodes starting at index. The sequence may not run into the
+/// END_SECTION that terminates the function.
+static bool matches(const std::vector<Instruction> &instructions,
+                    std::size_t index, std::initializer_list<OpCode> pattern) {
+  if (index + pattern.size() >= instructions.size()) {
+    return false;
+  }
+  for (auto op : pattern) {
+    if (instructions[index++].opCode() != op) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::size_t fuseSuperinstructions(FunctionDef &function) {
+  auto &instructions = function.instructions;
+  std::size_t fused = 0;
+  std::size_t i = 0;
+
+  // Only the opcode of the first instruction in a sequence is rewritten.
+  while (i < instructions.size()) {
+    auto &instruction = instructions[i];
+    if (matches(instructions, i,
+                {OpCode::PUSH_FROM_LOCAL, OpCode::PUSH_FROM_LOCAL,
+                 OpCode::INT_ADD})) {
+      instruction.opCode(OpCode::INT_ADD_LOCAL_LOCAL);
+      i += 3;
+    } else if (matches(instructions, i,
+                       {OpCode::PUSH_FROM_PARAM, OpCode::INT_PUSH_CONSTANT,
+                        OpCode::INT_SUB})) {
+      instruction.opCode(OpCode::INT_SUB_PARAM_CONSTANT);
+      i += 3;
+    } else if (matches(instructions, i,
+                       {OpCode::INT_PUSH_CONSTANT, OpCode::JMP_EQ}) &&
+               instruction.immediate() == 0) {
+      instruction.opCode(OpCode::JMP_EQ_ZERO);
+      i += 2;
+    } else {
+      i += 1;
+      continue;
+    }
+    fused++;
+  }
+
+  return fused;
+}
+
+std::shared_ptr<Module> fuseSuperinstructions(const Module &module) {
+  auto result = std::make_shared<Module>(module);
+  for (auto &function : result->functions) {
+    fuseSuperinstructions(function);
+  }
+  return result;
+}
+
+OpCode unfused(OpCode op) {
+  switch (op) {
+    case OpCode::INT_ADD_LOCAL_LOCAL:
+      return OpCode::PUSH_FROM_LOCAL;
+    case OpCode::INT_SUB_PARAM_CONSTANT:
+      return OpCode::PUSH_FROM_PARAM;
+    case OpCode::JMP_EQ_ZERO:
+      return OpCode::INT_PUSH_CONSTANT;
+    default:
+      return op;
+  }
+}
+
+}  // namespace b9
@@ -0,0 +1,70 @@
+#include <b9/ThreadedCode.hpp>
+
+#include <algorithm>
+#include <sstream>
+
+namespace b9 {
+
+static bool isJump(OpCode op) {
+  switch (op) {
+    case OpCode::JMP:
+    case OpCode::JMP_EQ:
+    case OpCode::JMP_NEQ:
+    case OpCode::JMP_GT:
+    case OpCode::JMP_GE:
+    case OpCode::JMP_LT:
+    case OpCode::JMP_LE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool isObjectAccess(OpCode op) {
+  return op == OpCode::PUSH_FROM_OBJECT || op == OpCode::POP_INTO_OBJECT;
+}
+
+ThreadedFunction translate(const FunctionDef &function,
+                           const void *const handlers[],
+                           std::size_t handlerCount,
+                           const void *unknownHandler) {
+  const auto &instructions = function.instructions;
+  ThreadedFunction result;
+  auto &code = result.code;
+  auto &caches = result.caches;
+
+  code.resize(instructions.size());
+
+  // Reserve every cache up front, so they never move.
+  caches.reserve(std::count_if(
+      instructions.begin(), instructions.end(),
+      [](Instruction i) { return isObjectAccess(i.opCode()); }));
+
+  for (std::size_t i = 0; i < instructions.size(); i++) {
+    const Instruction instruction = instructions[i];
+    const RawOpCode op = RawOpCode(instruction.opCode());
+    ThreadedInstruction &entry = code[i];
+
+    entry.handler = op < handlerCount ? handlers[op] : unknownHandler;
+
+    if (isJump(instruction.opCode())) {
+      // Jumps are relative to the instruction following the jump.
+      std::int64_t destination = std::int64_t(i) + instruction.immediate() + 1;
+      if (destination < 0 || destination >= std::int64_t(code.size())) {
+        std::stringstream message;
+        message << function.name << ": jump at " << i << " out of range";
+        throw TranslationException{message.str()};
+      }
+      entry.target = &code[destination];
+    } else if (isObjectAccess(instruction.opCode())) {
+      caches.emplace_back(Om::Id(instruction.immediate()));
+      entry.cache = &caches.back();
+    } else {
+      entry.immediate = instruction.immediate();
+    }
+  }
+
+  return result;
+}
+
+}  // namespace b9
@@ -0,0 +1,50 @@
+#include "b9/compiler/ThunkBuilder.hpp"
+
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+ThunkBuilder::ThunkBuilder(TR::TypeDictionary *types,
+                           const GlobalTypes &globalTypes, std::size_t nparams)
+    : TR::MethodBuilder(types), globalTypes_(globalTypes), nparams_(nparams) {
+  DefineLine("<unknown>");
+  DefineFile(__FILE__);
+
+  DefineName("b9_jit_thunk");
+
+  DefineReturnType(globalTypes_.stackElement);
+
+  DefineParameter("executionContext", globalTypes_.executionContextPtr);
+  DefineParameter("target", Address);
+  DefineParameter("args", globalTypes_.stackElementPtr);
+
+  // The signature of the target. ComputedCall takes the address at runtime.
+  std::vector<TR::IlType *> signature(nparams_ + 1,
+                                      globalTypes_.stackElement);
+  signature[0] = globalTypes_.executionContextPtr;
+  DefineFunction((char *)"jitFunction", (char *)__FILE__, "jitFunction",
+                 nullptr, globalTypes_.stackElement, signature.size(),
+                 signature.data());
+}
+
+bool ThunkBuilder::buildIL() {
+  // The target, then the execution context, then the arguments left-to-right.
+  std::vector<TR::IlValue *> args;
+  args.reserve(nparams_ + 2);
+
+  args.push_back(Load("target"));
+  args.push_back(Load("executionContext"));
+
+  TR::IlValue *base = Load("args");
+  for (std::size_t i = 0; i < nparams_; i++) {
+    TR::IlValue *address =
+        IndexAt(globalTypes_.stackElementPtr, base, ConstInt32(i));
+    args.push_back(LoadAt(globalTypes_.stackElementPtr, address));
+  }
+
+  Return(ComputedCall("jitFunction", args.size(), args.data()));
+  return true;
+}
+
+}  // namespace b9
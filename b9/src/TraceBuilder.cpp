@@ -0,0 +1,199 @@
+#include "b9/compiler/TraceBuilder.hpp"
+#include "b9/Superinstructions.hpp"
+#include "b9/VirtualMachine.hpp"
+#include "b9/compiler/Compiler.hpp"
+#include "b9/instructions.hpp"
+
+#include <OMR/Om/ValueBuilder.hpp>
+
+namespace b9 {
+
+TraceBuilder::TraceBuilder(VirtualMachine &virtualMachine, const Trace &trace)
+    : TR::MethodBuilder(&virtualMachine.compiler()->typeDictionary()),
+      globalTypes_(virtualMachine.compiler()->globalTypes()),
+      trace_(trace),
+      function_(*virtualMachine.getFunction(trace.functionIndex)) {
+  DefineLine("<unknown>");
+  DefineFile(__FILE__);
+
+  DefineName("b9_jit_trace");
+
+  DefineReturnType(globalTypes_.size);
+
+  DefineParameter("executionContext", globalTypes_.executionContextPtr);
+  DefineParameter("params", globalTypes_.stackElementPtr);
+  DefineParameter("locals", globalTypes_.stackElementPtr);
+
+  DefineLocal("running", Int32);
+}
+
+bool TraceBuilder::buildIL() {
+  // The iteration leaves the stack as it found it, so the recorded path is
+  // simply run again. Only a side exit leaves the loop.
+  TR::IlBuilder *body = nullptr;
+  Store("running", ConstInt32(1));
+  WhileDoLoop("running", &body);
+
+  for (const auto &step : trace_.steps) {
+    generateStep(body, step);
+  }
+
+  Return(ConstInteger(globalTypes_.size, trace_.header));
+  return true;
+}
+
+/// The jump that compares the same way, but jumps when op doesn't.
+static OpCode invert(OpCode op) {
+  switch (op) {
+    case OpCode::JMP_EQ:
+      return OpCode::JMP_NEQ;
+    case OpCode::JMP_NEQ:
+      return OpCode::JMP_EQ;
+    case OpCode::JMP_GT:
+      return OpCode::JMP_LE;
+    case OpCode::JMP_GE:
+      return OpCode::JMP_LT;
+    case OpCode::JMP_LT:
+      return OpCode::JMP_GE;
+    default:  // JMP_LE
+      return OpCode::JMP_GT;
+  }
+}
+
+/// True if the jump op would be taken, given two int48s.
+static TR::IlValue *compare(TR::IlBuilder *b, OpCode op, TR::IlValue *left,
+                            TR::IlValue *right) {
+  switch (op) {
+    case OpCode::JMP_EQ:
+      return b->EqualTo(left, right);
+    case OpCode::JMP_NEQ:
+      return b->NotEqualTo(left, right);
+    case OpCode::JMP_GT:
+      return b->GreaterThan(left, right);
+    case OpCode::JMP_GE:
+      return b->GreaterOrEqualTo(left, right);
+    case OpCode::JMP_LT:
+      return b->LessThan(left, right);
+    default:  // JMP_LE
+      return b->LessOrEqualTo(left, right);
+  }
+}
+
+void TraceBuilder::generateStep(TR::IlBuilder *b, const TraceStep &step) {
+  const Instruction instruction = function_.instructions[step.bytecodeIndex];
+  const std::size_t immediate = instruction.immediate();
+  const OpCode op = unfused(instruction.opCode());
+
+  switch (op) {
+    case OpCode::JMP:
+      break;
+    case OpCode::DUPLICATE:
+      stack_.push_back(stack_.back());
+      break;
+    case OpCode::DROP:
+      pop();
+      break;
+    case OpCode::PUSH_FROM_LOCAL:
+      stack_.push_back(
+          loadInt48(b, "locals", immediate, step.bytecodeIndex));
+      break;
+    case OpCode::POP_INTO_LOCAL:
+      b->StoreAt(slot(b, "locals", immediate),
+                 OMR::Om::ValueBuilder::fromInt48(b, pop()));
+      break;
+    case OpCode::PUSH_FROM_PARAM:
+      stack_.push_back(
+          loadInt48(b, "params", immediate, step.bytecodeIndex));
+      break;
+    case OpCode::POP_INTO_PARAM:
+      b->StoreAt(slot(b, "params", immediate),
+                 OMR::Om::ValueBuilder::fromInt48(b, pop()));
+      break;
+    case OpCode::INT_ADD: {
+      TR::IlValue *right = pop();
+      TR::IlValue *left = pop();
+      stack_.push_back(b->Add(left, right));
+      break;
+    }
+    case OpCode::INT_SUB: {
+      TR::IlValue *right = pop();
+      TR::IlValue *left = pop();
+      stack_.push_back(b->Sub(left, right));
+      break;
+    }
+    case OpCode::INT_MUL: {
+      TR::IlValue *right = pop();
+      TR::IlValue *left = pop();
+      stack_.push_back(b->Mul(left, right));
+      break;
+    }
+    case OpCode::INT_DIV: {
+      TR::IlValue *right = pop();
+      TR::IlValue *left = pop();
+      stack_.push_back(b->Div(left, right));
+      break;
+    }
+    case OpCode::INT_PUSH_CONSTANT:
+      stack_.push_back(b->ConstInteger(globalTypes_.stackElement,
+                                       instruction.immediate()));
+      break;
+    case OpCode::INT_NOT: {
+      TR::IlValue *zero = b->ConstInteger(globalTypes_.stackElement, 0);
+      stack_.push_back(b->ConvertTo(globalTypes_.stackElement,
+                                    b->EqualTo(pop(), zero)));
+      break;
+    }
+    default: {
+      // A conditional jump. Leave if it goes the way the recording didn't.
+      TR::IlValue *right = pop();
+      TR::IlValue *left = pop();
+      std::size_t target = step.bytecodeIndex + instruction.immediate() + 1;
+      if (step.taken) {
+        exitIf(b, compare(b, invert(op), left, right), step.bytecodeIndex + 1);
+      } else {
+        exitIf(b, compare(b, op, left, right), target);
+      }
+      break;
+    }
+  }
+}
+
+TR::IlValue *TraceBuilder::slot(TR::IlBuilder *b, const char *frame,
+                                std::size_t index) {
+  return b->IndexAt(globalTypes_.stackElementPtr, b->Load(frame),
+                    b->ConstInt32(index));
+}
+
+TR::IlValue *TraceBuilder::loadInt48(TR::IlBuilder *b, const char *frame,
+                                     std::size_t index,
+                                     std::size_t bytecodeIndex) {
+  TR::IlValue *value =
+      b->LoadAt(globalTypes_.stackElementPtr, slot(b, frame, index));
+  exitIf(b,
+         b->EqualTo(OMR::Om::ValueBuilder::isInt48(b, value), b->ConstInt32(0)),
+         bytecodeIndex);
+  return OMR::Om::ValueBuilder::getInt48(b, value);
+}
+
+void TraceBuilder::exitIf(TR::IlBuilder *b, TR::IlValue *condition,
+                          std::size_t bytecodeIndex) {
+  TR::IlBuilder *exit = nullptr;
+  b->IfThen(&exit, condition);
+
+  // Write the modelled stack back, boxed, above where the interpreter left it.
+  TR::IlValue *stack = exit->StructFieldInstanceAddress(
+      "b9::ExecutionContext", "stack_", exit->Load("executionContext"));
+  TR::IlValue *top = exit->LoadIndirect("b9::OperandStack", "top_", stack);
+  for (std::size_t i = 0; i < stack_.size(); i++) {
+    exit->StoreAt(
+        exit->IndexAt(globalTypes_.stackElementPtr, top, exit->ConstInt32(i)),
+        OMR::Om::ValueBuilder::fromInt48(exit, stack_[i]));
+  }
+  exit->StoreIndirect("b9::OperandStack", "top_", stack,
+                      exit->IndexAt(globalTypes_.stackElementPtr, top,
+                                    exit->ConstInt32(stack_.size())));
+
+  exit->Return(exit->ConstInteger(globalTypes_.size, bytecodeIndex));
+}
+
+}  // namespace b9
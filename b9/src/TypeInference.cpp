@@ -0,0 +1,201 @@
+#include "b9/compiler/TypeInference.hpp"
+#include "b9/VirtualMachine.hpp"
+#include "b9/instructions.hpp"
+
+namespace b9 {
+
+constexpr std::size_t TypeInference::ENTRY;
+
+/// The number of values each primitive pops. Every primitive pushes the int48
+/// 0. See primitives.cpp.
+static bool primitiveArity(Immediate index, std::size_t &arity) {
+  switch (index) {
+    case 0:  // print_string ( string -- 0 )
+    case 1:  // print_number ( number -- 0 )
+      arity = 1;
+      return true;
+    case 2:  // print_stack ( -- 0 )
+      arity = 0;
+      return true;
+    default:
+      return false;
+  }
+}
+
+TypeInference::TypeInference(VirtualMachine &virtualMachine,
+                             const FunctionDef &function)
+    : virtualMachine_(virtualMachine),
+      function_(function),
+      int48Locals_(function.nlocals, true),
+      reached_(function.instructions.size(), false),
+      entries_(function.instructions.size()),
+      predecessors_(function.instructions.size()) {
+  analyze();
+}
+
+void TypeInference::analyze() {
+  using Stack = std::vector<ValueType>;
+
+  const auto &program = function_.instructions;
+  ok_ = !program.empty();
+
+  // Every local starts out as an int48. Storing anything else into one changes
+  // what loading it pushes, so the reached loads of the local are revisited.
+  std::vector<std::vector<std::size_t>> loads(function_.nlocals);
+  for (std::size_t i = 0; i < program.size(); i++) {
+    if (program[i].opCode() == OpCode::PUSH_FROM_LOCAL &&
+        std::size_t(program[i].immediate()) < loads.size()) {
+      loads[program[i].immediate()].push_back(i);
+    }
+  }
+
+  // The function entry counts as a predecessor of the first instruction.
+  std::vector<std::size_t> worklist;
+  if (ok_) {
+    reached_[0] = true;
+    predecessors_[0].insert(ENTRY);
+    worklist.push_back(0);
+  }
+
+  // Join the stack into the entry of the target, and revisit the target if its
+  // entry changed.
+  auto flowTo = [&](std::size_t from, std::size_t target, const Stack &stack) {
+    if (target >= program.size()) return false;
+    predecessors_[target].insert(from);
+    Stack &entry = entries_[target];
+    if (!reached_[target]) {
+      reached_[target] = true;
+      entry = stack;
+      worklist.push_back(target);
+      return true;
+    }
+    if (entry.size() != stack.size()) return false;
+    bool widened = false;
+    for (std::size_t i = 0; i < entry.size(); i++) {
+      if (entry[i] != stack[i] && entry[i] != ValueType::ANY) {
+        entry[i] = ValueType::ANY;
+        widened = true;
+      }
+    }
+    if (widened) worklist.push_back(target);
+    return true;
+  };
+
+  while (ok_ && !worklist.empty()) {
+    std::size_t i = worklist.back();
+    worklist.pop_back();
+    const Instruction instruction = program[i];
+    Stack stack = entries_[i];
+    std::size_t next = i + 1;
+    std::size_t target = i + instruction.immediate() + 1;
+    bool jumps = false;
+
+    auto pop = [&](std::size_t n) {
+      if (stack.size() < n) return false;
+      stack.resize(stack.size() - n);
+      return true;
+    };
+
+    std::size_t arity = 0;
+    switch (instruction.opCode()) {
+      case OpCode::FUNCTION_RETURN:
+        if (stack.empty()) ok_ = false;
+        if (stack.size() != 1) balancedReturns_ = false;
+        continue;
+      case OpCode::FUNCTION_CALL:
+        arity = virtualMachine_.getFunction(instruction.immediate())->nparams;
+        ok_ = pop(arity);
+        stack.push_back(ValueType::ANY);
+        break;
+      case OpCode::PRIMITIVE_CALL:
+        ok_ = primitiveArity(instruction.immediate(), arity) && pop(arity);
+        stack.push_back(ValueType::INT48);
+        break;
+      case OpCode::JMP:
+        ok_ = flowTo(i, target, stack);
+        continue;
+      case OpCode::DUPLICATE:
+        ok_ = !stack.empty();
+        if (ok_) stack.push_back(stack.back());
+        break;
+      case OpCode::DROP:
+      case OpCode::POP_INTO_PARAM:
+        ok_ = pop(1);
+        break;
+      case OpCode::PUSH_FROM_LOCAL:
+        stack.push_back(int48Locals_[instruction.immediate()]
+                            ? ValueType::INT48
+                            : ValueType::ANY);
+        break;
+      case OpCode::POP_INTO_LOCAL:
+        ok_ = !stack.empty();
+        if (ok_ && stack.back() != ValueType::INT48 &&
+            int48Locals_[instruction.immediate()]) {
+          int48Locals_[instruction.immediate()] = false;
+          for (auto load : loads[instruction.immediate()]) {
+            if (reached_[load]) worklist.push_back(load);
+          }
+        }
+        pop(1);
+        break;
+      case OpCode::PUSH_FROM_PARAM:
+      case OpCode::STR_PUSH_CONSTANT:
+      case OpCode::NEW_OBJECT:
+        stack.push_back(ValueType::ANY);
+        break;
+      case OpCode::INT_PUSH_CONSTANT:
+        stack.push_back(ValueType::INT48);
+        break;
+      case OpCode::INT_ADD:
+      case OpCode::INT_SUB:
+      case OpCode::INT_MUL:
+      case OpCode::INT_DIV:
+        ok_ = pop(2);
+        stack.push_back(ValueType::INT48);
+        break;
+      case OpCode::INT_NOT:
+        ok_ = pop(1);
+        stack.push_back(ValueType::INT48);
+        break;
+      case OpCode::PUSH_FROM_OBJECT:
+        ok_ = pop(1);
+        stack.push_back(ValueType::ANY);
+        break;
+      case OpCode::POP_INTO_OBJECT:
+        ok_ = pop(2);
+        break;
+      case OpCode::SYSTEM_COLLECT:
+        break;
+      case OpCode::JMP_EQ:
+      case OpCode::JMP_NEQ:
+      case OpCode::JMP_GT:
+      case OpCode::JMP_GE:
+      case OpCode::JMP_LT:
+      case OpCode::JMP_LE:
+        ok_ = pop(2);
+        jumps = true;
+        break;
+      case OpCode::INT_ADD_LOCAL_LOCAL:
+      case OpCode::INT_SUB_PARAM_CONSTANT:
+        stack.push_back(ValueType::INT48);
+        next = i + 3;
+        break;
+      case OpCode::JMP_EQ_ZERO:
+        // The jump is the second instruction of the sequence.
+        ok_ = i + 1 < program.size() && pop(1);
+        if (ok_) target = i + program[i + 1].immediate() + 2;
+        jumps = true;
+        next = i + 2;
+        break;
+      default:
+        // END_SECTION, CALL_INDIRECT, or something we don't understand.
+        ok_ = false;
+        break;
+    }
+
+    if (ok_ && jumps) ok_ = flowTo(i, target, stack);
+    if (ok_) ok_ = flowTo(i, next, stack);
+  }
+}
+
+}  // namespace b9
@@ -1,4 +1,5 @@
 #include <b9/ExecutionContext.hpp>
+#include <b9/Superinstructions.hpp>
 #include <b9/VirtualMachine.hpp>
 #include <b9/compiler/Compiler.hpp>
 
@@ -20,11 +21,17 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <tuple>
+#include <utility>
 
 namespace b9 {
 
 constexpr PrimitiveFunction *const VirtualMachine::primitives_[3];
 
+// Compiled code reads linkage table entries as plain pointers.
+static_assert(sizeof(std::atomic<JitFunction>) == sizeof(JitFunction),
+              "Linkage table entries must be pointer sized");
+
 VirtualMachine::VirtualMachine(Om::ProcessRuntime &runtime, const Config &cfg)
     : cfg_{cfg}, memoryManager_(runtime), compiler_{nullptr} {
   if (cfg_.verbose) std::cout << "VM initializing..." << std::endl;
@@ -36,18 +43,51 @@ VirtualMachine::VirtualMachine(Om::ProcessRuntime &runtime, const Config &cfg)
     }
 
     compiler_ = std::make_shared<Compiler>(*this, cfg_);
+
+    if (cfg_.backgroundCompile) {
+      compileQueue_ = std::make_unique<CompileQueue>(
+          [this](std::size_t index) { compileAndInstall(index); });
+    }
   }
 }
 
 VirtualMachine::~VirtualMachine() noexcept {
+  // Stop compiling before the JIT goes away.
+  compileQueue_.reset();
+
   if (cfg_.jit) {
     shutdownJit();
   }
 }
 
 void VirtualMachine::load(std::shared_ptr<const Module> module) {
+  // Don't let a background compile install code into the new module.
+  waitForCompiles();
+
+  if (cfg_.superinstructions) {
+    module = fuseSuperinstructions(*module);
+  }
   module_ = module;
-  compiledFunctions_.reserve(getFunctionCount());
+  osrEntries_.clear();
+  loops_.clear();
+  jitPropertyCaches_.clear();
+  if (cfg_.opStats) {
+    opStats_.reset(new OpStats());
+  }
+  if (cfg_.profile) {
+    profiler_.reset(new Profiler());
+  }
+  if (cfg_.callProfile) {
+    callProfile_.reset(new CallProfile());
+  }
+  compiledFunctions_ =
+      std::vector<std::atomic<JitFunction>>(getFunctionCount());
+  for (auto &entry : compiledFunctions_) {
+    entry.store(nullptr, std::memory_order_relaxed);
+  }
+  profiles_.assign(getFunctionCount(), FunctionProfile());
+  threadedCode_.clear();
+  threadedCode_.resize(getFunctionCount());
 }
 
 /// OpCode Interpreter
@@ -56,12 +96,100 @@ JitFunction VirtualMachine::getJitAddress(std::size_t functionIndex) {
   if (functionIndex >= compiledFunctions_.size()) {
     return nullptr;
   }
-  return compiledFunctions_[functionIndex];
+  // Pairs with the release in setJitAddress, so the code is visible before
+  // it's run.
+  return compiledFunctions_[functionIndex].load(std::memory_order_acquire);
 }
 
 void VirtualMachine::setJitAddress(std::size_t functionIndex,
                                    JitFunction value) {
-  compiledFunctions_[functionIndex] = value;
+  compiledFunctions_[functionIndex].store(value, std::memory_order_release);
+}
+
+JitThunk VirtualMachine::getJitThunk(std::size_t nparams) {
+  if (nparams >= thunks_.size()) {
+    thunks_.resize(nparams + 1, nullptr);
+  }
+  if (thunks_[nparams] == nullptr) {
+    std::lock_guard<std::mutex> lock(compilerMutex_);
+    thunks_[nparams] = compiler_->generateThunk(nparams);
+  }
+  return thunks_[nparams];
+}
+
+void VirtualMachine::waitForCompiles() {
+  if (compileQueue_) {
+    compileQueue_->drain();
+  }
+}
+
+void VirtualMachine::printCompileStatistics(std::ostream &out) const {
+  if (compileQueue_) {
+    out << compileQueue_->statistics() << std::endl;
+  }
+}
+
+ThreadedFunction &VirtualMachine::getThreadedCode(std::size_t functionIndex) {
+  return threadedCode_[functionIndex];
+}
+
+PropertyCache &VirtualMachine::getJitPropertyCache(std::size_t functionIndex,
+                                                   std::size_t bytecodeIndex,
+                                                   Om::Id slotId) {
+  std::lock_guard<std::mutex> lock(jitPropertyCachesMutex_);
+  // Map nodes don't move, so compiled code can hold on to the cache.
+  return jitPropertyCaches_
+      .emplace(std::piecewise_construct,
+               std::forward_as_tuple(functionIndex, bytecodeIndex),
+               std::forward_as_tuple(slotId))
+      .first->second;
+}
+
+void VirtualMachine::flushPropertyCaches() {
+  for (auto &threaded : threadedCode_) {
+    for (auto &cache : threaded.caches) {
+      cache.flush();
+    }
+  }
+  std::lock_guard<std::mutex> lock(jitPropertyCachesMutex_);
+  for (auto &cache : jitPropertyCaches_) {
+    cache.second.flush();
+  }
+}
+
+void VirtualMachine::printPropertyCacheStatistics(std::ostream &out) const {
+  std::uint64_t hits = 0;
+  std::uint64_t misses = 0;
+  std::size_t sites = 0;
+  std::size_t polymorphic = 0;
+  std::size_t megamorphic = 0;
+
+  auto count = [&](const PropertyCache &cache) {
+    hits += cache.hits();
+    misses += cache.misses();
+    sites++;
+    if (cache.size() == PropertyCache::SIZE) {
+      megamorphic++;
+    } else if (cache.size() > 1) {
+      polymorphic++;
+    }
+  };
+
+  for (const auto &threaded : threadedCode_) {
+    for (const auto &cache : threaded.caches) {
+      count(cache);
+    }
+  }
+  // Hits in compiled code are checked inline, and aren't counted here.
+  std::lock_guard<std::mutex> lock(jitPropertyCachesMutex_);
+  for (const auto &cache : jitPropertyCaches_) {
+    count(cache.second);
+  }
+
+  out << "Inline caches:  " << sites << " sites, " << polymorphic
+      << " polymorphic, " << megamorphic << " full" << std::endl
+      << "Cache hits:     " << hits << std::endl
+      << "Cache misses:   " << misses << std::endl;
 }
 
 PrimitiveFunction *VirtualMachine::getPrimitive(std::size_t index) {
@@ -73,8 +201,13 @@ const FunctionDef *VirtualMachine::getFunction(std::size_t index) {
 }
 
 JitFunction VirtualMachine::generateCode(const std::size_t functionIndex) {
+  std::lock_guard<std::mutex> lock(compilerMutex_);
+  return compile(functionIndex);
+}
+
+JitFunction VirtualMachine::compile(std::size_t functionIndex) {
   try {
-    return compiler_->generateCode(functionIndex);
+    return compiler_->generateCode(functionIndex, nextTier(functionIndex));
   } catch (const CompilationException &e) {
     auto f = getFunction(functionIndex);
     std::cerr << "Warning: Failed to compile " << f << std::endl;
@@ -83,6 +216,179 @@ JitFunction VirtualMachine::generateCode(const std::size_t functionIndex) {
   }
 }
 
+JitFunction VirtualMachine::countInvocation(std::size_t functionIndex) {
+  auto &profile = profiles_[functionIndex];
+  profile.invocations++;
+  if (!cfg_.tiered || profile.count() < cfg_.tierUpThreshold) {
+    return getJitAddress(functionIndex);
+  }
+  return tierUp(functionIndex);
+}
+
+OsrFunction VirtualMachine::countBackEdge(std::size_t functionIndex,
+                                          std::size_t target) {
+  auto &profile = profiles_[functionIndex];
+  profile.backEdges++;
+  if (!cfg_.tiered || profile.count() < cfg_.tierUpThreshold) {
+    return nullptr;
+  }
+  tierUp(functionIndex);
+  return getOsrEntry(functionIndex, target);
+}
+
+OsrFunction VirtualMachine::getOsrEntry(std::size_t functionIndex,
+                                        std::size_t target) {
+  auto key = std::make_pair(functionIndex, target);
+  auto found = osrEntries_.find(key);
+  if (found != osrEntries_.end()) {
+    return found->second;
+  }
+
+  // OSR entries take their arguments from the interpreter's frame, which
+  // doesn't fit the pass-param calling convention.
+  OsrFunction osrFunction = nullptr;
+  if (!cfg_.passParam) {
+    // The frame is waiting on this, so it's compiled here. Only a compile
+    // already running on the background thread is waited for, not the
+    // rest of its queue.
+    std::lock_guard<std::mutex> lock(compilerMutex_);
+
+    if (cfg_.verbose) {
+      std::cout << "OSR into function: " << getFunction(functionIndex)->name
+                << " at: " << target << std::endl;
+    }
+
+    try {
+      osrFunction = compiler_->generateOsrCode(functionIndex, target);
+    } catch (const CompilationException &e) {
+      std::cerr << "Warning: Failed to compile OSR entry for "
+                << getFunction(functionIndex)->name << std::endl;
+      std::cerr << "    with error: " << e.what() << std::endl;
+    }
+  }
+
+  osrEntries_[key] = osrFunction;
+  return osrFunction;
+}
+
+TraceFunction VirtualMachine::countLoop(std::size_t functionIndex,
+                                        std::size_t header, bool &record) {
+  auto &loop = loops_[std::make_pair(functionIndex, header)];
+  if (loop.trace) {
+    return loop.trace;
+  }
+  loop.iterations++;
+  record = !loop.recorded && loop.iterations >= cfg_.tierUpThreshold;
+  loop.recorded = loop.recorded || record;
+  return nullptr;
+}
+
+TraceFunction VirtualMachine::getTrace(std::size_t functionIndex,
+                                       std::size_t header) const {
+  auto loop = loops_.find(std::make_pair(functionIndex, header));
+  return loop == loops_.end() ? nullptr : loop->second.trace;
+}
+
+void VirtualMachine::compileTrace(const Trace &trace) {
+  // Only a compile already running on the background thread is waited for,
+  // not the rest of its queue.
+  std::lock_guard<std::mutex> lock(compilerMutex_);
+
+  if (cfg_.verbose) {
+    std::cout << "Compiling trace: " << getFunction(trace.functionIndex)->name
+              << " at: " << trace.header << " length: " << trace.steps.size()
+              << std::endl;
+  }
+
+  try {
+    loops_[std::make_pair(trace.functionIndex, trace.header)].trace =
+        compiler_->generateTraceCode(trace);
+  } catch (const CompilationException &e) {
+    std::cerr << "Warning: Failed to compile trace for "
+              << getFunction(trace.functionIndex)->name << std::endl;
+    std::cerr << "    with error: " << e.what() << std::endl;
+  }
+}
+
+JitFunction VirtualMachine::tierUp(std::size_t functionIndex) {
+  auto &profile = profiles_[functionIndex];
+  if (profile.compiled) {
+    return getJitAddress(functionIndex);
+  }
+  profile.compiled = true;
+
+  if (cfg_.verbose) {
+    std::cout << "Tiering up function: " << getFunction(functionIndex)->name
+              << " invocations: " << profile.invocations
+              << " back-edges: " << profile.backEdges << std::endl;
+  }
+
+  if (compileQueue_) {
+    compileQueue_->request(functionIndex);
+    return nullptr;
+  }
+
+  compileAndInstall(functionIndex);
+  return getJitAddress(functionIndex);
+}
+
+void VirtualMachine::deoptimized(std::size_t functionIndex) {
+  auto &profile = profiles_[functionIndex];
+  if (profile.deoptimizations++ != 0) {
+    return;
+  }
+
+  // The background queue isn't drained. A compile of this function already
+  // running installs before this one starts, since compileAndInstall holds
+  // the compiler mutex until it installs. One still queued starts after the
+  // deoptimization is counted, so it doesn't speculate either.
+  for (auto entry = osrEntries_.begin(); entry != osrEntries_.end();) {
+    if (entry->first.first == functionIndex) {
+      entry = osrEntries_.erase(entry);
+    } else {
+      ++entry;
+    }
+  }
+  compileAndInstall(functionIndex);
+}
+
+void VirtualMachine::recompileHot(std::size_t functionIndex) {
+  auto &profile = profiles_[functionIndex];
+  if (profile.optimized) {
+    return;
+  }
+  profile.optimized = true;
+
+  if (cfg_.verbose) {
+    std::cout << "Recompiling hot function: "
+              << getFunction(functionIndex)->name
+              << " warm invocations: " << profile.warmInvocations
+              << " warm back-edges: " << profile.warmBackEdges << std::endl;
+  }
+
+  if (compileQueue_) {
+    compileQueue_->request(functionIndex);
+    return;
+  }
+
+  compileAndInstall(functionIndex);
+}
+
+Tier VirtualMachine::nextTier(std::size_t functionIndex) const {
+  if (!cfg_.multiTier) {
+    return Tier::DEFAULT;
+  }
+  return profiles_[functionIndex].optimized ? Tier::HOT : Tier::WARM;
+}
+
+void VirtualMachine::compileAndInstall(std::size_t functionIndex) {
+  std::lock_guard<std::mutex> lock(compilerMutex_);
+  auto jitFunction = compile(functionIndex);
+  if (jitFunction != nullptr) {
+    setJitAddress(functionIndex, jitFunction);
+  }
+}
+
 const std::string &VirtualMachine::getString(int index) {
   return module_->strings[index];
 }
@@ -93,14 +399,17 @@ std::size_t VirtualMachine::getFunctionCount() {
 
 void VirtualMachine::generateAllCode() {
   assert(cfg_.jit);
+  std::lock_guard<std::mutex> lock(compilerMutex_);
   auto functionIndex = 0;  // 0 index for <script>
 
   while (functionIndex < getFunctionCount()) {
     if (cfg_.debug)
       std::cout << "\nJitting function: " << getFunction(functionIndex)->name
                 << " of index: " << functionIndex << std::endl;
-    auto func = compiler_->generateCode(functionIndex);
-    compiledFunctions_.push_back(func);
+    auto func =
+        compiler_->generateCode(functionIndex, nextTier(functionIndex));
+    setJitAddress(functionIndex, func);
+    profiles_[functionIndex].compiled = true;
     ++functionIndex;
   }
 }
@@ -115,7 +424,7 @@ StackElement VirtualMachine::run(const std::size_t functionIndex,
   auto function = getFunction(functionIndex);
   auto paramsCount = function->nparams;
 
-  ExecutionContext *executionContext = new ExecutionContext(*this, cfg_);
+  ExecutionContext executionContext(*this, cfg_);
 
   if (cfg_.verbose) {
     std::cout << "+++++++++++++++++++++++" << std::endl;
@@ -135,10 +444,12 @@ StackElement VirtualMachine::run(const std::size_t functionIndex,
   for (std::size_t i = 0; i < paramsCount; i++) {
     auto idx = paramsCount - i - 1;
     auto arg = usrArgs[idx];
-    executionContext->push(arg);
+    executionContext.push(arg);
   }
 
-  StackElement result = executionContext->interpret(functionIndex);
+  Profiler::Session profiling(profiler_.get(),
+                             executionContext.shadowFrames());
+  StackElement result = executionContext.interpret(functionIndex);
 
   return result;
 }
@@ -161,4 +472,45 @@ void primitive_call(ExecutionContext *context, Immediate value) {
   context->doPrimitiveCall(value);
 }
 
+void new_object(ExecutionContext *context) { context->doNewObject(); }
+
+// The object and value were already popped by compiled code. Push them back,
+// so they are rooted while the slow path runs.
+
+Om::RawValue push_from_object(ExecutionContext *context, PropertyCache *cache,
+                              Om::RawValue object) {
+  context->push(Om::Value(Om::AS_RAW, object));
+  context->doPushFromObject(*cache);
+  return context->pop().raw();
+}
+
+void pop_into_object(ExecutionContext *context, PropertyCache *cache,
+                     Om::RawValue object, Om::RawValue value) {
+  context->push(Om::Value(Om::AS_RAW, value));
+  context->push(Om::Value(Om::AS_RAW, object));
+  context->doPopIntoObject(*cache);
+}
+
+void call_indirect(ExecutionContext *context) { context->doCallIndirect(); }
+
+void system_collect(ExecutionContext *context) { context->doSystemCollect(); }
+
+std::int32_t compare_values(ExecutionContext *context, std::int32_t op,
+                            Om::RawValue left, Om::RawValue right) {
+  return context->doCompare(OpCode(op), Om::Value(Om::AS_RAW, left),
+                            Om::Value(Om::AS_RAW, right));
+}
+
+Om::RawValue deoptimize(ExecutionContext *context, std::size_t functionIndex,
+                        std::size_t bytecodeIndex, Om::Value *stackBase,
+                        Om::Value *operandBase) {
+  return context
+      ->resume(functionIndex, bytecodeIndex, stackBase, operandBase)
+      .raw();
+}
+
+void recompile_hot(ExecutionContext *context, std::size_t functionIndex) {
+  context->virtualMachine()->recompileHot(functionIndex);
+}
+
 }  // extern "C"
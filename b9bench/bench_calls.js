@@ -0,0 +1,12 @@
+// Recursive calls: every call is a FUNCTION_CALL and FUNCTION_RETURN.
+
+function fib(n) {
+    if (n < 2) {
+        return n;
+    }
+    return fib(n - 1) + fib(n - 2);
+}
+
+function bench() {
+    return fib(24);
+}
@@ -0,0 +1,9 @@
+// A tight integer loop, in one frame.
+
+function bench() {
+    var sum = 0;
+    for (var i = 0; i < 1000000; i++) {
+        sum = sum + i;
+    }
+    return sum;
+}
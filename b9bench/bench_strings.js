@@ -0,0 +1,16 @@
+// String compares, half equal and half not.
+
+function same(a, b) {
+    if (a == b) {
+        return 1;
+    }
+    return 0;
+}
+
+function bench() {
+    var hits = 0;
+    for (var i = 0; i < 100000; i++) {
+        hits = hits + same("left", "left") + same("left", "right");
+    }
+    return hits;
+}
@@ -0,0 +1,302 @@
+#include <b9/ExecutionContext.hpp>
+#include <b9/compiler/Compiler.hpp>
+#include <b9/deserialize.hpp>
+
+#include <OMR/Om/Runtime.hpp>
+
+#include <strings.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// B9bench's usage string. Printed when run with -help.
+static const char* usage =
+    "Usage: b9bench [<option>...] [--] [<module>...]\n"
+    "   Or: b9bench -help\n"
+    "Runs the function bench() of each module, and of the built in object\n"
+    "benchmarks, in each execution mode, and writes the times as JSON.\n"
+    "Options:\n"
+    "  -warmup <n>:     Untimed runs before timing (default: 3)\n"
+    "  -iterations <n>: Timed runs (default: 10)\n"
+    "  -mode <name>:    Only run one mode: interpreter, jit, directcall,\n"
+    "                   passparam or lazyvmstate\n"
+    "  -out <file>:     Write the JSON to file, rather than stdout\n"
+    "  -help:           Print this help message";
+
+using namespace b9;
+
+namespace {
+
+/// A way of running the benchmarks.
+struct Mode {
+  const char* name;
+  Config cfg;
+};
+
+std::vector<Mode> modes() {
+  Config jit;
+  jit.jit = true;
+  Config directCall = jit;
+  directCall.directCall = true;
+  Config passParam = directCall;
+  passParam.passParam = true;
+  Config lazyVmState = passParam;
+  lazyVmState.lazyVmState = true;
+  return {{"interpreter", Config()},
+          {"jit", jit},
+          {"directcall", directCall},
+          {"passparam", passParam},
+          {"lazyvmstate", lazyVmState}};
+}
+
+/// b9bench's configuration.
+struct BenchConfig {
+  std::size_t warmup = 3;
+  std::size_t iterations = 10;
+  const char* mode = nullptr;
+  const char* out = nullptr;
+  std::vector<const char*> modules;
+};
+
+/// A benchmark: a module with a function bench(), taking no arguments.
+struct Benchmark {
+  std::string name;
+  std::shared_ptr<const Module> module;
+};
+
+/// The times of one benchmark in one mode, in milliseconds.
+struct Result {
+  std::string benchmark;
+  const char* mode;
+  double compile;
+  std::vector<double> runs;  //< Sorted
+  StackElement value;
+};
+
+/// bench(): allocate an object per iteration, store a slot into it, and
+/// answer the last object's slot.
+std::shared_ptr<Module> makeObjectsModule() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::POP_INTO_LOCAL, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 100000},
+                                {OpCode::JMP_GE, 10},
+                                {OpCode::NEW_OBJECT},
+                                {OpCode::POP_INTO_LOCAL, 1},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 1},
+                                {OpCode::POP_INTO_OBJECT, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::INT_ADD},
+                                {OpCode::POP_INTO_LOCAL, 0},
+                                {OpCode::JMP, -13},
+                                {OpCode::PUSH_FROM_LOCAL, 1},
+                                {OpCode::PUSH_FROM_OBJECT, 0},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(FunctionDef{"bench", i, 0, 2});
+  return m;
+}
+
+/// bench(): increment a slot of one object, and answer it.
+std::shared_ptr<Module> makePropertiesModule() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::NEW_OBJECT},
+                                {OpCode::POP_INTO_LOCAL, 1},
+                                {OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 1},
+                                {OpCode::POP_INTO_OBJECT, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::POP_INTO_LOCAL, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 100000},
+                                {OpCode::JMP_GE, 11},
+                                {OpCode::PUSH_FROM_LOCAL, 1},
+                                {OpCode::PUSH_FROM_OBJECT, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::INT_ADD},
+                                {OpCode::PUSH_FROM_LOCAL, 1},
+                                {OpCode::POP_INTO_OBJECT, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::INT_ADD},
+                                {OpCode::POP_INTO_LOCAL, 0},
+                                {OpCode::JMP, -14},
+                                {OpCode::PUSH_FROM_LOCAL, 1},
+                                {OpCode::PUSH_FROM_OBJECT, 0},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(FunctionDef{"bench", i, 0, 2});
+  return m;
+}
+
+/// The name of a module file, without its directory or extension.
+std::string benchmarkName(const std::string& path) {
+  std::string name = path.substr(path.find_last_of('/') + 1);
+  return name.substr(0, name.find('.'));
+}
+
+/// Parse CLI arguments and set up the config.
+bool parseArguments(BenchConfig& cfg, const int argc, char* argv[]) {
+  int i = 1;
+
+  for (; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (strcasecmp(arg, "-help") == 0) {
+      std::cout << usage << std::endl;
+      exit(EXIT_SUCCESS);
+    } else if (strcasecmp(arg, "-warmup") == 0 && i + 1 < argc) {
+      cfg.warmup = std::strtoull(argv[++i], nullptr, 10);
+    } else if (strcasecmp(arg, "-iterations") == 0 && i + 1 < argc) {
+      cfg.iterations = std::strtoull(argv[++i], nullptr, 10);
+    } else if (strcasecmp(arg, "-mode") == 0 && i + 1 < argc) {
+      cfg.mode = argv[++i];
+    } else if (strcasecmp(arg, "-out") == 0 && i + 1 < argc) {
+      cfg.out = argv[++i];
+    } else if (strcmp(arg, "--") == 0) {
+      i++;
+      break;
+    } else if (arg[0] == '-') {
+      std::cerr << "Unrecognized option: " << arg << std::endl;
+      return false;
+    } else {
+      break;
+    }
+  }
+
+  for (; i < argc; i++) {
+    cfg.modules.push_back(argv[i]);
+  }
+
+  if (cfg.iterations == 0) {
+    std::cerr << "-iterations must be at least 1" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double, std::milli> ms =
+      std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+/// Run a benchmark in a fresh virtual machine.
+Result run(Om::ProcessRuntime& runtime, const BenchConfig& cfg,
+           const Benchmark& benchmark, const Mode& mode) {
+  Result result{benchmark.name, mode.name, 0, {}, {}};
+  VirtualMachine vm{runtime, mode.cfg};
+  vm.load(benchmark.module);
+
+  if (mode.cfg.jit) {
+    auto start = std::chrono::steady_clock::now();
+    vm.generateAllCode();
+    result.compile = elapsedMs(start);
+  }
+
+  for (std::size_t i = 0; i < cfg.warmup; i++) {
+    vm.run("bench", {});
+  }
+
+  for (std::size_t i = 0; i < cfg.iterations; i++) {
+    auto start = std::chrono::steady_clock::now();
+    result.value = vm.run("bench", {});
+    result.runs.push_back(elapsedMs(start));
+  }
+
+  std::sort(result.runs.begin(), result.runs.end());
+  return result;
+}
+
+/// The nearest-rank percentile of sorted runs.
+double percentile(const std::vector<double>& runs, double p) {
+  std::size_t rank = std::size_t(p / 100 * runs.size() + 0.5);
+  return runs[std::min(std::max<std::size_t>(rank, 1), runs.size()) - 1];
+}
+
+void printJson(std::ostream& out, const BenchConfig& cfg,
+               const std::vector<Result>& results) {
+  out << "{\n  \"warmup\": " << cfg.warmup
+      << ",\n  \"iterations\": " << cfg.iterations << ",\n  \"results\": [";
+  const char* separator = "\n";
+  for (const auto& result : results) {
+    out << separator << "    {\"benchmark\": \"" << result.benchmark
+        << "\", \"mode\": \"" << result.mode
+        << "\", \"compile_ms\": " << result.compile
+        << ", \"min_ms\": " << result.runs.front()
+        << ", \"median_ms\": " << percentile(result.runs, 50)
+        << ", \"p90_ms\": " << percentile(result.runs, 90)
+        << ", \"p99_ms\": " << percentile(result.runs, 99)
+        << ", \"max_ms\": " << result.runs.back() << ", \"result\": \""
+        << result.value << "\"}";
+    separator = ",\n";
+  }
+  out << "\n  ]\n}" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Om::ProcessRuntime runtime;
+  BenchConfig cfg;
+
+  if (!parseArguments(cfg, argc, argv)) {
+    std::cerr << usage << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  std::vector<Benchmark> benchmarks;
+  try {
+    for (const char* path : cfg.modules) {
+      std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+      benchmarks.push_back({benchmarkName(path), deserialize(file)});
+    }
+  } catch (const DeserializeException& e) {
+    std::cerr << "Failed to load module: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  benchmarks.push_back({"objects", makeObjectsModule()});
+  benchmarks.push_back({"properties", makePropertiesModule()});
+
+  std::vector<Result> results;
+  bool found = false;
+  for (const auto& mode : modes()) {
+    if (cfg.mode && strcasecmp(cfg.mode, mode.name) != 0) {
+      continue;
+    }
+    found = true;
+    for (const auto& benchmark : benchmarks) {
+      try {
+        results.push_back(run(runtime, cfg, benchmark, mode));
+      } catch (const std::exception& e) {
+        std::cerr << "Failed to run " << benchmark.name << " in " << mode.name
+                  << " mode: " << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+
+  if (!found) {
+    std::cerr << "Unknown mode: " << cfg.mode << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (cfg.out) {
+    std::ofstream out(cfg.out);
+    printJson(out, cfg, results);
+  } else {
+    printJson(std::cout, cfg, results);
+  }
+
+  exit(EXIT_SUCCESS);
+}
@@ -20,11 +20,28 @@ static const char* usage =
     "   Or: b9run -help\n"
     "Jit Options:\n"
     "  -jit:          Enable the jit\n"
+    "  -tiered:       Only jit functions once they are hot\n"
+    "  -threshold <n>: Calls and loops before tiering up (default: 1000)\n"
+    "  -background:   Compile tiered functions on a background thread\n"
+    "  -multitier:    Compile cheaply, then recompile hot code, inlining\n"
+    "  -hotthreshold <n>: Warm calls and loops to recompile (default: 10000)\n"
+    "  -trace:        Only jit hot loops, as recorded traces\n"
+    "  -perfmap:      Write /tmp/perf-<pid>.map, naming jitted code for perf\n"
     "  -directcall:   make direct jit to jit calls\n"
     "  -passparam:    Pass arguments in CPU registers\n"
     "  -lazyvmstate:  Only update the VM state as needed\n"
+    "  -speculate:    Speculate on value types, deoptimizing on failure\n"
     "Run Options:\n"
+    "  -threaded:     Use the threaded interpreter\n"
+    "  -fuse:         Fuse common sequences into superinstructions\n"
     "  -inline <n>:   Set the jit's max inline depth (default: 0)\n"
+    "  -stacksize <n>: Set the operand stack size (default: 1000 elements)\n"
+    "  -icstats:      Print inline cache statistics after the run\n"
+    "  -compilestats: Print background compile statistics after the run\n"
+    "  -opstats:      Print interpreted bytecode counts after the run\n"
+    "  -opstatsjson <file>: Also write the bytecode counts to file as JSON\n"
+    "  -profile <file>: Sample the run, writing folded stacks to file\n"
+    "  -callprofile:  Print call counts and times per function after the run\n"
     "  -debug:        Enable debug code\n"
     "  -verbose:      Run with verbose printing\n"
     "  -help:         Print this help message";
@@ -35,6 +52,10 @@ struct RunConfig {
   const char* moduleName = "";
   const char* mainFunction = "<script>";
   bool verbose = false;
+  bool icStats = false;
+  bool compileStats = false;
+  const char* opStatsJson = nullptr;
+  const char* profileFile = nullptr;
   std::vector<b9::StackElement> usrArgs;
 };
 
@@ -63,19 +84,55 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
       exit(EXIT_SUCCESS);
     } else if (strcasecmp(arg, "-inline") == 0) {
       cfg.b9.maxInlineDepth = atoi(argv[++i]);
+    } else if (strcasecmp(arg, "-stacksize") == 0) {
+      cfg.b9.stackSize = std::strtoull(argv[++i], nullptr, 10);
     } else if (strcasecmp(arg, "-verbose") == 0) {
       cfg.verbose = true;
       cfg.b9.verbose = true;
+    } else if (strcasecmp(arg, "-icstats") == 0) {
+      cfg.icStats = true;
+    } else if (strcasecmp(arg, "-compilestats") == 0) {
+      cfg.compileStats = true;
+    } else if (strcasecmp(arg, "-opstats") == 0) {
+      cfg.b9.opStats = true;
+    } else if (strcasecmp(arg, "-opstatsjson") == 0) {
+      cfg.b9.opStats = true;
+      cfg.opStatsJson = argv[++i];
+    } else if (strcasecmp(arg, "-profile") == 0) {
+      cfg.b9.profile = true;
+      cfg.profileFile = argv[++i];
+    } else if (strcasecmp(arg, "-callprofile") == 0) {
+      cfg.b9.callProfile = true;
     } else if (strcasecmp(arg, "-debug") == 0) {
       cfg.b9.debug = true;
+    } else if (strcasecmp(arg, "-threaded") == 0) {
+      cfg.b9.threaded = true;
+    } else if (strcasecmp(arg, "-fuse") == 0) {
+      cfg.b9.superinstructions = true;
     } else if (strcasecmp(arg, "-jit") == 0) {
       cfg.b9.jit = true;
+    } else if (strcasecmp(arg, "-tiered") == 0) {
+      cfg.b9.tiered = true;
+    } else if (strcasecmp(arg, "-threshold") == 0) {
+      cfg.b9.tierUpThreshold = std::strtoull(argv[++i], nullptr, 10);
+    } else if (strcasecmp(arg, "-background") == 0) {
+      cfg.b9.backgroundCompile = true;
+    } else if (strcasecmp(arg, "-multitier") == 0) {
+      cfg.b9.multiTier = true;
+    } else if (strcasecmp(arg, "-hotthreshold") == 0) {
+      cfg.b9.hotThreshold = std::strtoull(argv[++i], nullptr, 10);
+    } else if (strcasecmp(arg, "-trace") == 0) {
+      cfg.b9.traceJit = true;
+    } else if (strcasecmp(arg, "-perfmap") == 0) {
+      cfg.b9.perfMap = true;
     } else if (strcasecmp(arg, "-directcall") == 0) {
       cfg.b9.directCall = true;
     } else if (strcasecmp(arg, "-passparam") == 0) {
       cfg.b9.passParam = true;
     } else if (strcasecmp(arg, "-lazyvmstate") == 0) {
       cfg.b9.lazyVmState = true;
+    } else if (strcasecmp(arg, "-speculate") == 0) {
+      cfg.b9.speculate = true;
     } else if (strcmp(arg, "--") == 0) {
       i++;
       break;
@@ -101,6 +158,52 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
   }
 
   // check that dependent options are enabled
+  if (cfg.b9.tiered && !cfg.b9.jit) {
+    std::cerr << "-tiered requires -jit" << std::endl;
+    return false;
+  }
+  if (cfg.b9.backgroundCompile && !cfg.b9.tiered) {
+    std::cerr << "-background requires -tiered" << std::endl;
+    return false;
+  }
+  if (cfg.b9.multiTier && !cfg.b9.jit) {
+    std::cerr << "-multitier requires -jit" << std::endl;
+    return false;
+  }
+  if (cfg.b9.traceJit && !cfg.b9.jit) {
+    std::cerr << "-trace requires -jit" << std::endl;
+    return false;
+  }
+  if (cfg.b9.traceJit && cfg.b9.threaded) {
+    std::cerr << "-trace records in the switch interpreter, not -threaded"
+              << std::endl;
+    return false;
+  }
+  if (cfg.b9.perfMap && !cfg.b9.jit) {
+    std::cerr << "-perfmap requires -jit" << std::endl;
+    return false;
+  }
+#if !defined(B9_OPSTATS)
+  if (cfg.b9.opStats) {
+    std::cerr << "-opstats requires a build with B9_OPSTATS" << std::endl;
+    return false;
+  }
+#endif  // B9_OPSTATS
+  if (cfg.b9.opStats && cfg.b9.threaded) {
+    std::cerr << "-opstats counts in the switch interpreter, not -threaded"
+              << std::endl;
+    return false;
+  }
+  if (cfg.b9.profile && cfg.b9.threaded) {
+    std::cerr << "-profile walks the switch interpreter's frames, not -threaded"
+              << std::endl;
+    return false;
+  }
+  if (cfg.b9.callProfile && cfg.b9.threaded) {
+    std::cerr << "-callprofile measures the switch interpreter, not -threaded"
+              << std::endl;
+    return false;
+  }
   if (cfg.b9.directCall && !cfg.b9.jit) {
     std::cerr << "-directcall requires -jit" << std::endl;
     return false;
@@ -113,6 +216,10 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
     std::cerr << "-lazyvmstate requires -passparam" << std::endl;
     return false;
   }
+  if (cfg.b9.speculate && !cfg.b9.jit) {
+    std::cerr << "-speculate requires -jit" << std::endl;
+    return false;
+  }
 
   return true;
 }
@@ -124,13 +231,42 @@ static void run(Om::ProcessRuntime& runtime, const RunConfig& cfg) {
   auto module = b9::deserialize(file);
   vm.load(module);
 
-  if (cfg.b9.jit) {
+  if (cfg.b9.jit && !cfg.b9.tiered && !cfg.b9.traceJit) {
     vm.generateAllCode();
   }
 
   size_t functionIndex = module->getFunctionIndex(cfg.mainFunction);
   auto result = vm.run(functionIndex, cfg.usrArgs);
   std::cout << std::endl << "=> " << result << std::endl;
+
+  if (cfg.icStats) {
+    vm.printPropertyCacheStatistics(std::cout);
+  }
+
+  if (cfg.compileStats) {
+    vm.printCompileStatistics(std::cout);
+  }
+
+  if (cfg.b9.opStats) {
+    vm.opStats()->print(std::cout, *module);
+    if (cfg.opStatsJson) {
+      std::ofstream json(cfg.opStatsJson);
+      vm.opStats()->printJson(json, *module);
+    }
+  }
+
+  if (cfg.b9.callProfile) {
+    vm.callProfile()->print(std::cout, *module);
+  }
+
+  if (cfg.b9.profile) {
+    std::ofstream folded(cfg.profileFile);
+    vm.profiler()->write(folded, vm);
+    if (cfg.verbose) {
+      std::cout << "Profile samples: " << vm.profiler()->samples()
+                << ", dropped: " << vm.profiler()->dropped() << std::endl;
+    }
+  }
 }
 
 int main(int argc, char* argv[]) {
@@ -160,6 +296,9 @@ int main(int argc, char* argv[]) {
   } catch (const b9::CompilationException& e) {
     std::cerr << "Failed to compile function: " << e.what() << std::endl;
     exit(EXIT_FAILURE);
+  } catch (const b9::StackOverflowException& e) {
+    std::cerr << "Stack overflow: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   }
 
   exit(EXIT_SUCCESS);
@@ -1,10 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <b9/CallProfile.hpp>
 #include <b9/ExecutionContext.hpp>
+#include <b9/OpStats.hpp>
+#include <b9/Profiler.hpp>
+#include <b9/PropertyCache.hpp>
+#include <b9/Superinstructions.hpp>
+#include <b9/compiler/PerfMap.hpp>
+#include <b9/compiler/TypeInference.hpp>
 #include <b9/deserialize.hpp>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -71,6 +80,18 @@ TEST_F(InterpreterTest, interpreter) {
   }
 }
 
+TEST_F(InterpreterTest, threaded) {
+  Config cfg;
+  cfg.threaded = true;
+
+  VirtualMachine vm{runtime, cfg};
+  vm.load(module_);
+
+  for (auto test : TEST_NAMES) {
+    EXPECT_TRUE(vm.run(test, {}).getInt48()) << "Test Failed: " << test;
+  }
+}
+
 TEST_F(InterpreterTest, jit) {
   Config cfg;
   cfg.jit = true;
@@ -145,6 +166,76 @@ TEST(MyTest, arguments) {
   EXPECT_EQ(r, Value(AS_INT48, 3));
 }
 
+TEST(MyTest, passManyArguments) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.directCall = true;
+  cfg.passParam = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::PUSH_FROM_PARAM, 1},
+                                {OpCode::INT_SUB},
+                                {OpCode::PUSH_FROM_PARAM, 2},
+                                {OpCode::INT_ADD},
+                                {OpCode::PUSH_FROM_PARAM, 3},
+                                {OpCode::INT_ADD},
+                                {OpCode::PUSH_FROM_PARAM, 4},
+                                {OpCode::INT_MUL},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"args5", i, 5, 0});
+  vm.load(m);
+  vm.generateAllCode();
+  auto r = vm.run("args5", {{AS_INT48, 10},
+                            {AS_INT48, 4},
+                            {AS_INT48, 3},
+                            {AS_INT48, 2},
+                            {AS_INT48, 5}});
+  EXPECT_EQ(r, Value(AS_INT48, 55));
+}
+
+// The callee is compiled after its caller, so the call is late-bound. It goes
+// through the interpreter until the callee is compiled, and then calls it
+// directly.
+TEST(MyTest, lateBoundCall) {
+  for (bool passParam : {false, true}) {
+    Config cfg;
+    cfg.jit = true;
+    cfg.directCall = true;
+    cfg.passParam = passParam;
+    cfg.callProfile = true;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    // main(a): sub(a, 3)
+    std::vector<Instruction> main = {{OpCode::PUSH_FROM_PARAM, 0},
+                                     {OpCode::INT_PUSH_CONSTANT, 3},
+                                     {OpCode::FUNCTION_CALL, 1},
+                                     {OpCode::FUNCTION_RETURN},
+                                     END_SECTION};
+    std::vector<Instruction> sub = {{OpCode::PUSH_FROM_PARAM, 0},
+                                    {OpCode::PUSH_FROM_PARAM, 1},
+                                    {OpCode::INT_SUB},
+                                    {OpCode::FUNCTION_RETURN},
+                                    END_SECTION};
+    m->functions.push_back(b9::FunctionDef{"main", main, 1, 0});
+    m->functions.push_back(b9::FunctionDef{"sub", sub, 2, 0});
+    vm.load(m);
+    auto profile = vm.callProfile();
+
+    vm.setJitAddress(0, vm.generateCode(0));
+    EXPECT_EQ(vm.run("main", {{AS_INT48, 10}}), Value(AS_INT48, 7));
+    EXPECT_EQ(profile->calls(1), 1);
+
+    // Calls that enter compiled code directly never reach the interpreter.
+    vm.setJitAddress(1, vm.generateCode(1));
+    EXPECT_EQ(vm.run("main", {{AS_INT48, 10}}), Value(AS_INT48, 7));
+    EXPECT_EQ(vm.run("main", {{AS_INT48, 10}}), Value(AS_INT48, 7));
+    EXPECT_EQ(profile->calls(0), 3);
+    EXPECT_EQ(profile->calls(1), 1);
+  }
+}
+
 TEST(MyTest, jitSimpleProgram) {
   Config cfg;
   cfg.jit = true;
@@ -175,6 +266,545 @@ TEST(MyTest, haveAVariable) {
   EXPECT_EQ(r, Value(AS_INT48, 0xdead));
 }
 
+TEST(InlineTest, inlineSmallFunction) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.maxInlineDepth = 1;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  // main(a): sub2(a) + 1
+  std::vector<Instruction> main = {{OpCode::PUSH_FROM_PARAM, 0},
+                                   {OpCode::FUNCTION_CALL, 1},
+                                   {OpCode::INT_PUSH_CONSTANT, 1},
+                                   {OpCode::INT_ADD},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  // sub2(x): y = x - 2; if (y < 0) return 0; return y
+  std::vector<Instruction> sub2 = {{OpCode::PUSH_FROM_PARAM, 0},
+                                   {OpCode::INT_PUSH_CONSTANT, 2},
+                                   {OpCode::INT_SUB},
+                                   {OpCode::POP_INTO_LOCAL, 0},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::INT_PUSH_CONSTANT, 0},
+                                   {OpCode::JMP_GE, 2},
+                                   {OpCode::INT_PUSH_CONSTANT, 0},
+                                   {OpCode::FUNCTION_RETURN},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"main", main, 1, 0});
+  m->functions.push_back(b9::FunctionDef{"sub2", sub2, 1, 1});
+  vm.load(m);
+  vm.generateAllCode();
+  EXPECT_EQ(vm.run("main", {{AS_INT48, 10}}), Value(AS_INT48, 9));
+  EXPECT_EQ(vm.run("main", {{AS_INT48, 1}}), Value(AS_INT48, 1));
+}
+
+TEST(SuperinstructionTest, fuseAndRun) {
+  Config cfg;
+  cfg.superinstructions = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {
+      {OpCode::INT_PUSH_CONSTANT, 20},  // local0 = 20
+      {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::PUSH_FROM_PARAM, 0},  // local1 = param0 - 1
+      {OpCode::INT_PUSH_CONSTANT, 1},
+      {OpCode::INT_SUB},
+      {OpCode::POP_INTO_LOCAL, 1},
+      {OpCode::PUSH_FROM_LOCAL, 1},  // if (local1 == 0) return 0
+      {OpCode::INT_PUSH_CONSTANT, 0},
+      {OpCode::JMP_EQ, 4},
+      {OpCode::PUSH_FROM_LOCAL, 0},  // return local0 + local1
+      {OpCode::PUSH_FROM_LOCAL, 1},
+      {OpCode::INT_ADD},
+      {OpCode::FUNCTION_RETURN},
+      {OpCode::INT_PUSH_CONSTANT, 0},
+      {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  FunctionDef f{"fused", i, 1, 2};
+
+  EXPECT_EQ(fuseSuperinstructions(f), 3u);
+  EXPECT_EQ(f.instructions[2].opCode(), OpCode::INT_SUB_PARAM_CONSTANT);
+  EXPECT_EQ(f.instructions[6].opCode(), OpCode::PUSH_FROM_LOCAL);
+  EXPECT_EQ(f.instructions[7].opCode(), OpCode::JMP_EQ_ZERO);
+  EXPECT_EQ(f.instructions[9].opCode(), OpCode::INT_ADD_LOCAL_LOCAL);
+
+  m->functions.push_back(b9::FunctionDef{"fused", i, 1, 2});
+  vm.load(m);
+  EXPECT_EQ(vm.run("fused", {{AS_INT48, 3}}), Value(AS_INT48, 22));
+  EXPECT_EQ(vm.run("fused", {{AS_INT48, 1}}), Value(AS_INT48, 0));
+}
+
+/// count(n) calls itself n times, and answers n.
+static std::shared_ptr<Module> makeRecursiveModule() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::JMP_NEQ, 2},
+                                {OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::FUNCTION_RETURN},
+                                {OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::INT_SUB},
+                                {OpCode::FUNCTION_CALL, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::INT_ADD},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"count", i, 1, 0});
+  return m;
+}
+
+TEST(CallProfileTest, recursiveCalls) {
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    cfg.callProfile = true;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(makeRecursiveModule());
+    if (jit) {
+      vm.generateAllCode();
+    }
+    EXPECT_EQ(vm.run("count", {{AS_INT48, 10}}), Value(AS_INT48, 10));
+
+    auto profile = vm.callProfile();
+    EXPECT_EQ(profile->calls(0), 11);
+    EXPECT_EQ(profile->edgeCount(CallProfile::ROOT, 0), 1);
+    EXPECT_EQ(profile->edgeCount(0, 0), 10);
+    // Recursive calls are only counted once in the inclusive time.
+    EXPECT_GE(profile->inclusive(0), profile->exclusive(0));
+  }
+}
+
+TEST(ThreadedTest, recursiveCalls) {
+  Config cfg;
+  cfg.threaded = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeRecursiveModule());
+  EXPECT_EQ(vm.run("count", {{AS_INT48, 300}}), Value(AS_INT48, 300));
+}
+
+TEST(TieredTest, compilesHotFunctions) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.tierUpThreshold = 10;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeRecursiveModule());
+  EXPECT_EQ(vm.run("count", {{AS_INT48, 5}}), Value(AS_INT48, 5));
+  EXPECT_EQ(vm.getJitAddress(0), nullptr);
+  EXPECT_EQ(vm.getProfile(0).invocations, 6);
+  EXPECT_EQ(vm.run("count", {{AS_INT48, 20}}), Value(AS_INT48, 20));
+  EXPECT_NE(vm.getJitAddress(0), nullptr);
+  EXPECT_TRUE(vm.getProfile(0).compiled);
+}
+
+TEST(TieredTest, compilesInBackground) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.backgroundCompile = true;
+  cfg.tierUpThreshold = 10;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeRecursiveModule());
+  // The interpreter keeps running while the function compiles.
+  EXPECT_EQ(vm.run("count", {{AS_INT48, 20}}), Value(AS_INT48, 20));
+  vm.waitForCompiles();
+  EXPECT_NE(vm.getJitAddress(0), nullptr);
+  EXPECT_EQ(vm.run("count", {{AS_INT48, 20}}), Value(AS_INT48, 20));
+}
+
+// loop(n): Count up to n in a local. Returns n.
+static std::shared_ptr<Module> makeLoopModule() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::POP_INTO_LOCAL, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::JMP_GE, 5},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::INT_ADD},
+                                {OpCode::POP_INTO_LOCAL, 0},
+                                {OpCode::JMP, -8},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"loop", i, 1, 1});
+  return m;
+}
+
+// A single call with a hot loop moves to compiled code part way through.
+TEST(TieredTest, onStackReplacement) {
+  for (bool threaded : {false, true}) {
+    Config cfg;
+    cfg.jit = true;
+    cfg.tiered = true;
+    cfg.threaded = threaded;
+    cfg.tierUpThreshold = 10;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(makeLoopModule());
+    EXPECT_EQ(vm.run("loop", {{AS_INT48, 100}}), Value(AS_INT48, 100));
+    EXPECT_EQ(vm.getProfile(0).invocations, 1);
+    EXPECT_NE(vm.getJitAddress(0), nullptr);
+  }
+}
+
+TEST(TieredTest, recompilesHotFunctions) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.multiTier = true;
+  cfg.tierUpThreshold = 10;
+  cfg.hotThreshold = 50;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeLoopModule());
+  // The first run moves to an OSR entry, and leaves warm code for next time.
+  EXPECT_EQ(vm.run("loop", {{AS_INT48, 100}}), Value(AS_INT48, 100));
+  auto warm = vm.getJitAddress(0);
+  EXPECT_NE(warm, nullptr);
+  EXPECT_FALSE(vm.getProfile(0).optimized);
+  // The warm code counts its loop, and is replaced once hot.
+  EXPECT_EQ(vm.run("loop", {{AS_INT48, 100}}), Value(AS_INT48, 100));
+  EXPECT_EQ(vm.getProfile(0).warmInvocations, 1);
+  EXPECT_TRUE(vm.getProfile(0).optimized);
+  EXPECT_NE(vm.getJitAddress(0), warm);
+  EXPECT_EQ(vm.run("loop", {{AS_INT48, 100}}), Value(AS_INT48, 100));
+  EXPECT_EQ(vm.getProfile(0).warmInvocations, 1);
+}
+
+// Warm code that starts with its count already past the threshold, as after
+// a deoptimization, still goes hot, and only once.
+TEST(TieredTest, recompilesPastHotThreshold) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.tiered = true;
+  cfg.multiTier = true;
+  cfg.tierUpThreshold = 10;
+  cfg.hotThreshold = 50;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeLoopModule());
+  EXPECT_EQ(vm.run("loop", {{AS_INT48, 100}}), Value(AS_INT48, 100));
+  auto warm = vm.getJitAddress(0);
+  EXPECT_NE(warm, nullptr);
+  vm.getProfile(0).warmBackEdges = cfg.hotThreshold + 5;
+
+  EXPECT_EQ(vm.run("loop", {{AS_INT48, 100}}), Value(AS_INT48, 100));
+  EXPECT_TRUE(vm.getProfile(0).optimized);
+  auto hot = vm.getJitAddress(0);
+  EXPECT_NE(hot, warm);
+  EXPECT_EQ(vm.run("loop", {{AS_INT48, 100}}), Value(AS_INT48, 100));
+  EXPECT_EQ(vm.getJitAddress(0), hot);
+}
+
+TEST(TraceTest, compilesHotLoop) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.traceJit = true;
+  cfg.tierUpThreshold = 10;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeLoopModule());
+  // The loop header is the first load of the local, at index 2.
+  EXPECT_EQ(vm.run("loop", {{AS_INT48, 100}}), Value(AS_INT48, 100));
+  EXPECT_NE(vm.getTrace(0, 2), nullptr);
+  EXPECT_EQ(vm.getJitAddress(0), nullptr);
+  // The trace leaves the loop through its side exit.
+  EXPECT_EQ(vm.run("loop", {{AS_INT48, 50}}), Value(AS_INT48, 50));
+  EXPECT_EQ(vm.run("loop", {{AS_INT48, 0}}), Value(AS_INT48, 0));
+}
+
+// A loop made of superinstructions is traced as the instructions they fuse.
+TEST(TraceTest, compilesFusedLoop) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.traceJit = true;
+  cfg.superinstructions = true;
+  cfg.tierUpThreshold = 10;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {
+      {OpCode::INT_PUSH_CONSTANT, 0},  // local0 = 0
+      {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::INT_PUSH_CONSTANT, 2},  // local1 = 2
+      {OpCode::POP_INTO_LOCAL, 1},
+      {OpCode::PUSH_FROM_PARAM, 0},  // while (param0 != 0)
+      {OpCode::INT_PUSH_CONSTANT, 0},
+      {OpCode::JMP_EQ, 9},
+      {OpCode::PUSH_FROM_LOCAL, 0},  // local0 = local0 + local1
+      {OpCode::PUSH_FROM_LOCAL, 1},
+      {OpCode::INT_ADD},
+      {OpCode::POP_INTO_LOCAL, 0},
+      {OpCode::PUSH_FROM_PARAM, 0},  // param0 = param0 - 1
+      {OpCode::INT_PUSH_CONSTANT, 1},
+      {OpCode::INT_SUB},
+      {OpCode::POP_INTO_PARAM, 0},
+      {OpCode::JMP, -12},
+      {OpCode::PUSH_FROM_LOCAL, 0},  // return local0
+      {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"double", i, 1, 2});
+  vm.load(m);
+  EXPECT_EQ(vm.getFunction(0)->instructions[5].opCode(), OpCode::JMP_EQ_ZERO);
+  EXPECT_EQ(vm.run("double", {{AS_INT48, 100}}), Value(AS_INT48, 200));
+  EXPECT_NE(vm.getTrace(0, 4), nullptr);
+  EXPECT_EQ(vm.run("double", {{AS_INT48, 50}}), Value(AS_INT48, 100));
+  EXPECT_EQ(vm.run("double", {{AS_INT48, 0}}), Value(AS_INT48, 0));
+}
+
+// Each body appends a line. A body that lands inside an earlier one cuts the
+// earlier one off, by appending its line again.
+TEST(PerfMapTest, appendsAndCutsOffBodies) {
+  PerfMap map;
+  char code[0x40];
+  auto a = reinterpret_cast<std::uintptr_t>(code);
+  map.add(code, "b9::a");
+  map.add(code + 0x20, "b9::b");
+  map.add(code + 0x10, "b9::c");
+
+  std::ostringstream expected;
+  expected << std::hex << a << " " << PerfMap::DEFAULT_SIZE << " b9::a\n"
+           << a << " 20 b9::a\n"
+           << a + 0x20 << " " << PerfMap::DEFAULT_SIZE << " b9::b\n"
+           << a << " 10 b9::a\n"
+           << a + 0x10 << " 10 b9::c\n";
+
+  std::ifstream file(map.path());
+  std::ostringstream written;
+  written << file.rdbuf();
+  EXPECT_EQ(written.str(), expected.str());
+  std::remove(map.path().c_str());
+}
+
+TEST(OpStatsTest, countsOpsPairsAndSites) {
+  OpStats stats;
+  {
+    OpStats::Frame frame(&stats, 1);
+    frame.step(0, OpCode::INT_PUSH_CONSTANT);
+    frame.step(1, OpCode::INT_PUSH_CONSTANT);
+    frame.step(2, OpCode::INT_ADD);
+    frame.step(0, OpCode::INT_PUSH_CONSTANT);
+  }
+  EXPECT_EQ(stats.count(OpCode::INT_PUSH_CONSTANT), 3);
+  EXPECT_EQ(stats.count(OpCode::INT_ADD), 1);
+  EXPECT_EQ(stats.pairCount(OpCode::INT_PUSH_CONSTANT, OpCode::INT_ADD), 1);
+  EXPECT_EQ(stats.pairCount(OpCode::INT_ADD, OpCode::INT_PUSH_CONSTANT), 1);
+  EXPECT_EQ(stats.pairCount(OpCode::INT_ADD, OpCode::INT_ADD), 0);
+  EXPECT_EQ(stats.siteCount(1, 0), 2);
+  EXPECT_EQ(stats.siteCount(0, 0), 0);
+
+  // A frame without stats counts nothing.
+  OpStats::Frame(nullptr, 0).step(0, OpCode::INT_ADD);
+  EXPECT_EQ(stats.count(OpCode::INT_ADD), 1);
+}
+
+TEST(ProfilerTest, foldsShadowFrames) {
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(makeLoopModule());
+  const Instruction *loop = vm.getFunction(0)->instructions.data();
+
+  // The timer never fires during the test; samples are taken by hand.
+  Profiler profiler(60 * 1000000);
+  std::atomic<const ShadowFrame *> top{nullptr};
+  {
+    ShadowFrame outer(&top, 0, loop);
+    outer.step(loop + 1);
+    Profiler::Session session(&profiler, top);
+    profiler.sample(0);
+    {
+      ShadowFrame inner(&top, 0, nullptr);
+      profiler.sample(0);
+    }
+    {
+      // Frames built without a chain, as when not profiling, aren't seen.
+      ShadowFrame unlinked(nullptr, 0, loop);
+      EXPECT_FALSE(unlinked.linked());
+      EXPECT_EQ(top.load(), &outer);
+    }
+    profiler.sample(0);
+  }
+  EXPECT_EQ(top.load(), nullptr);
+  EXPECT_EQ(profiler.samples(), 3);
+
+  std::ostringstream folded;
+  profiler.write(folded, vm);
+  EXPECT_EQ(folded.str(),
+            "loop;loop [compiled] 1\n"
+            "loop;loop@1 pop_into_local 2\n");
+}
+
+TEST(TypeInferenceTest, int48Locals) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto m = makeLoopModule();
+  // local1 = param0; it might not be an int48.
+  auto &loop = m->functions[0];
+  loop.nlocals = 2;
+  loop.instructions.insert(loop.instructions.begin(),
+                           {{OpCode::PUSH_FROM_PARAM, 0},
+                            {OpCode::POP_INTO_LOCAL, 1}});
+  vm.load(m);
+
+  TypeInference types(vm, *vm.getFunction(0));
+  EXPECT_TRUE(types.ok());
+  EXPECT_TRUE(types.isInt48Local(0));
+  EXPECT_FALSE(types.isInt48Local(1));
+  EXPECT_TRUE(types.hasBalancedReturns());
+  // The loop header is reached from the entry and the back edge.
+  EXPECT_TRUE(types.isMergePoint(4));
+  EXPECT_FALSE(types.isMergePoint(5));
+  EXPECT_EQ(types.stackTypes(6),
+            std::vector<ValueType>({ValueType::INT48, ValueType::ANY}));
+}
+
+TEST(TypeInferenceTest, unboxedLoop) {
+  for (bool lazyVmState : {false, true}) {
+    Config cfg;
+    cfg.jit = true;
+    cfg.directCall = true;
+    cfg.passParam = true;
+    cfg.lazyVmState = lazyVmState;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(makeLoopModule());
+    vm.generateAllCode();
+    EXPECT_EQ(vm.run("loop", {{AS_INT48, 1000}}), Value(AS_INT48, 1000));
+    EXPECT_EQ(vm.run("loop", {{AS_INT48, -5}}), Value(AS_INT48, 0));
+  }
+}
+
+// Compiled code speculates that comparisons are on int48s. Comparing strings
+// fails the guard, and the call finishes in the interpreter. Each comparison
+// answers as the interpreter does, before and after deoptimizing.
+class SpeculationTest : public ::testing::TestWithParam<OpCode> {};
+
+// compare(a, b): return a <op> b. Strings 0 and 1 are apple and banana.
+static std::shared_ptr<Module> makeCompareModule(OpCode op) {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::PUSH_FROM_PARAM, 0},
+                                {OpCode::PUSH_FROM_PARAM, 1},
+                                {op, 2},
+                                {OpCode::INT_PUSH_CONSTANT, 0},
+                                {OpCode::FUNCTION_RETURN},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"compare", i, 2, 0});
+  m->strings = {"apple", "banana"};
+  return m;
+}
+
+TEST_P(SpeculationTest, deoptimizeOnStrings) {
+  auto m = makeCompareModule(GetParam());
+
+  b9::VirtualMachine interpreter{runtime, {}};
+  interpreter.load(m);
+  const StackElement one{AS_INT48, 1};
+  const StackElement two{AS_INT48, 2};
+  const StackElement apple{AS_UINT48, 0};
+  const StackElement banana{AS_UINT48, 1};
+
+  for (bool lazyVmState : {false, true}) {
+    Config cfg;
+    cfg.jit = true;
+    cfg.speculate = true;
+    cfg.directCall = lazyVmState;
+    cfg.passParam = lazyVmState;
+    cfg.lazyVmState = lazyVmState;
+    b9::VirtualMachine vm{runtime, cfg};
+    vm.load(m);
+    vm.generateAllCode();
+
+    for (auto args : {std::make_pair(one, two), std::make_pair(two, one),
+                      std::make_pair(one, one)}) {
+      EXPECT_EQ(vm.run("compare", {args.first, args.second}),
+                interpreter.run("compare", {args.first, args.second}));
+    }
+    EXPECT_EQ(vm.getProfile(0).deoptimizations, 0);
+
+    EXPECT_EQ(vm.run("compare", {apple, banana}),
+              interpreter.run("compare", {apple, banana}));
+    EXPECT_EQ(vm.getProfile(0).deoptimizations, 1);
+
+    // The function was recompiled without speculating.
+    EXPECT_EQ(vm.run("compare", {banana, apple}),
+              interpreter.run("compare", {banana, apple}));
+    EXPECT_EQ(vm.run("compare", {two, one}),
+              interpreter.run("compare", {two, one}));
+    EXPECT_EQ(vm.getProfile(0).deoptimizations, 1);
+  }
+}
+
+// With a background compiler, a deoptimization recompiles on the interpreter
+// thread, without draining the queue, and the recompiled code doesn't
+// speculate.
+TEST(SpeculationTest, deoptimizeWithBackgroundCompiles) {
+  Config cfg;
+  cfg.jit = true;
+  cfg.speculate = true;
+  cfg.tiered = true;
+  cfg.backgroundCompile = true;
+  cfg.tierUpThreshold = 2;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeCompareModule(OpCode::JMP_LT));
+
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(vm.run("compare", {{AS_INT48, 1}, {AS_INT48, 2}}),
+              Value(AS_INT48, 1));
+  }
+  vm.waitForCompiles();
+  auto speculative = vm.getJitAddress(0);
+  EXPECT_NE(speculative, nullptr);
+
+  EXPECT_EQ(vm.run("compare", {{AS_UINT48, 0}, {AS_UINT48, 1}}),
+            Value(AS_INT48, 1));
+  EXPECT_EQ(vm.getProfile(0).deoptimizations, 1);
+  EXPECT_NE(vm.getJitAddress(0), speculative);
+
+  vm.waitForCompiles();
+  EXPECT_EQ(vm.run("compare", {{AS_UINT48, 1}, {AS_UINT48, 0}}),
+            Value(AS_INT48, 0));
+  EXPECT_EQ(vm.run("compare", {{AS_INT48, 2}, {AS_INT48, 1}}),
+            Value(AS_INT48, 0));
+  EXPECT_EQ(vm.getProfile(0).deoptimizations, 1);
+}
+
+INSTANTIATE_TEST_CASE_P(Comparisons, SpeculationTest,
+                        ::testing::Values(OpCode::JMP_EQ, OpCode::JMP_NEQ,
+                                          OpCode::JMP_GT, OpCode::JMP_GE,
+                                          OpCode::JMP_LT, OpCode::JMP_LE));
+
+#if defined(B9_COMPUTED_GOTO)
+// Only the threaded interpreter has a CallStack.
+TEST(ThreadedTest, callStackOverflow) {
+  Config cfg;
+  cfg.threaded = true;
+  cfg.maxCallDepth = 50;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeRecursiveModule());
+  EXPECT_EQ(vm.run("count", {{AS_INT48, 49}}), Value(AS_INT48, 49));
+  EXPECT_THROW(vm.run("count", {{AS_INT48, 100}}), StackOverflowException);
+}
+
+TEST(ThreadedTest, deepRecursion) {
+  Config cfg;
+  cfg.threaded = true;
+  cfg.stackSize = 1 << 20;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeRecursiveModule());
+  EXPECT_EQ(vm.run("count", {{AS_INT48, 50000}}), Value(AS_INT48, 50000));
+}
+#endif  // B9_COMPUTED_GOTO
+
+TEST(OperandStackTest, overflowIsCaught) {
+  EXPECT_EXIT(
+      {
+        OperandStack stack(16);
+        for (std::size_t i = 0; i <= stack.capacity(); i++) {
+          stack.push({AS_INT48, 0});
+        }
+      },
+      ::testing::ExitedWithCode(EXIT_FAILURE), "operand stack overflow");
+}
+
 TEST(ObjectTest, allocateSomething) {
   b9::VirtualMachine vm{runtime, {}};
   auto m = std::make_shared<Module>();
@@ -197,5 +827,127 @@ TEST(ObjectTest, allocateSomething) {
   EXPECT_EQ(r, Value(AS_INT48, 0));
 }
 
+// Two objects get the same slot, and are read back. Returns 3.
+static std::shared_ptr<Module> makeObjectModule() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> i = {{OpCode::NEW_OBJECT},
+                                {OpCode::POP_INTO_LOCAL, 0},
+                                {OpCode::NEW_OBJECT},
+                                {OpCode::POP_INTO_LOCAL, 1},
+                                {OpCode::INT_PUSH_CONSTANT, 1},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::POP_INTO_OBJECT, 0},
+                                {OpCode::INT_PUSH_CONSTANT, 2},
+                                {OpCode::PUSH_FROM_LOCAL, 1},
+                                {OpCode::POP_INTO_OBJECT, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 0},
+                                {OpCode::PUSH_FROM_OBJECT, 0},
+                                {OpCode::PUSH_FROM_LOCAL, 1},
+                                {OpCode::PUSH_FROM_OBJECT, 0},
+                                {OpCode::INT_ADD},
+                                {OpCode::FUNCTION_RETURN},
+                                END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"objects", i, 0, 2});
+  return m;
+}
+
+#if defined(B9_COMPUTED_GOTO)
+// Object slots read and written through the threaded inline caches.
+TEST(ObjectTest, inlineCache) {
+  Config cfg;
+  cfg.threaded = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeObjectModule());
+  EXPECT_EQ(vm.run("objects", {}), Value(AS_INT48, 3));
+}
+#endif  // B9_COMPUTED_GOTO
+
+TEST(ObjectTest, jitObjectAccess) {
+  Config cfg;
+  cfg.jit = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeObjectModule());
+  vm.generateAllCode();
+  EXPECT_NE(vm.getJitAddress(0), nullptr);
+  EXPECT_EQ(vm.run("objects", {}), Value(AS_INT48, 3));
+}
+
+// Once the first run has filled its cache, each read is a hit in compiled
+// code, and never reaches the runtime.
+TEST(ObjectTest, jitObjectAccessHitsInline) {
+  Config cfg;
+  cfg.jit = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  vm.load(makeObjectModule());
+  vm.generateAllCode();
+  vm.run("objects", {});
+
+  PropertyCache &cache = vm.getJitPropertyCache(0, 11, Id(0));
+  EXPECT_EQ(cache.size(), 1);
+  auto lookups = cache.hits() + cache.misses();
+  EXPECT_EQ(vm.run("objects", {}), Value(AS_INT48, 3));
+  EXPECT_EQ(vm.run("objects", {}), Value(AS_INT48, 3));
+  EXPECT_EQ(cache.hits() + cache.misses(), lookups);
+}
+
+// A store that adds a slot is cached with its transition. A second object of
+// the same shape hits, and takes the same shape.
+TEST(ObjectTest, cachedTransition) {
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(makeObjectModule());
+  ExecutionContext context(vm, vm.config());
+  PropertyCache cache(Id(0));
+
+  context.doNewObject();
+  RootRef<Object> first(context, context.pop().getRef<Object>());
+  context.push(Value(AS_INT48, 0));
+  context.push(Value(AS_REF, first.get()));
+  context.doPopIntoObject(cache);
+
+  context.doNewObject();
+  RootRef<Object> second(context, context.pop().getRef<Object>());
+  context.push(Value(AS_INT48, 1));
+  context.push(Value(AS_REF, second.get()));
+  context.doPopIntoObject(cache);
+
+  EXPECT_EQ(cache.misses(), 1);
+  EXPECT_EQ(cache.hits(), 1);
+  EXPECT_NE(cache.primary().transition, nullptr);
+  EXPECT_EQ(second.get()->layout(), first.get()->layout());
+  EXPECT_EQ(second.get()->layout(), cache.primary().transition);
+
+  SlotDescriptor descriptor;
+  ASSERT_TRUE(lookupSlot(context, second.get(), Id(0), descriptor));
+  EXPECT_EQ(getValue(context, second.get(), descriptor), Value(AS_INT48, 1));
+}
+
+// Compiled code reads an object's shape from its first word, and a slot at
+// its descriptor's offset from the start of the object. Pin both to what
+// Om's own accessors see.
+TEST(ObjectTest, jitSlotLayout) {
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(makeObjectModule());
+  ExecutionContext context(vm, vm.config());
+  PropertyCache cache(Id(0));
+
+  context.doNewObject();
+  Value ref = context.pop();
+  RootRef<Object> object(context, ref.getRef<Object>());
+  context.push(Value(AS_INT48, 42));
+  context.push(ref);
+  context.doPopIntoObject(cache);
+
+  const Object *raw = object.get();
+  EXPECT_EQ(*reinterpret_cast<const void *const *>(raw), raw->layout());
+
+  SlotDescriptor descriptor;
+  ASSERT_TRUE(lookupSlot(context, object.get(), Id(0), descriptor));
+  EXPECT_EQ(cache.primary().offset, descriptor.offset());
+  auto slot = reinterpret_cast<const RawValue *>(
+      reinterpret_cast<const char *>(raw) + descriptor.offset());
+  EXPECT_EQ(*slot, Value(AS_INT48, 42).raw());
+  EXPECT_EQ(*slot, getValue(context, object.get(), descriptor).raw());
+}
+
 }  // namespace test
 }  // namespace b9
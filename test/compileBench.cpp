@@ -0,0 +1,84 @@
+#include <b9/ExecutionContext.hpp>
+#include <b9/VirtualMachine.hpp>
+
+#include <OMR/Om/Runtime.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+/// Measures how long the jit takes to compile a function, as the function
+/// grows. Compile time should grow linearly with the number of bytecodes.
+///
+/// Usage: b9compilebench [<max instructions> [<repetitions>]]
+
+using namespace b9;
+
+namespace {
+
+/// Build a function of about size instructions. It counts up in a local, and
+/// compares the count after every step, so the IL has a merge point every few
+/// bytecodes, as loops and conditionals do.
+std::vector<Instruction> makeFunction(std::size_t size) {
+  std::vector<Instruction> program;
+  while (program.size() + 7 + 3 <= size) {
+    program.push_back({OpCode::PUSH_FROM_LOCAL, 0});
+    program.push_back({OpCode::INT_PUSH_CONSTANT, 1});
+    program.push_back({OpCode::INT_ADD});
+    program.push_back({OpCode::POP_INTO_LOCAL, 0});
+    program.push_back({OpCode::PUSH_FROM_LOCAL, 0});
+    program.push_back({OpCode::INT_PUSH_CONSTANT, 0});
+    program.push_back({OpCode::JMP_LT, 0});
+  }
+  program.push_back({OpCode::PUSH_FROM_LOCAL, 0});
+  program.push_back({OpCode::FUNCTION_RETURN});
+  program.push_back(END_SECTION);
+  return program;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::size_t maxSize = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 32768;
+  std::size_t repetitions = argc > 2 ? std::strtoul(argv[2], nullptr, 0) : 3;
+
+  Om::ProcessRuntime runtime;
+  Config cfg;
+  cfg.jit = true;
+
+  std::cout << std::setw(12) << "bytecodes" << std::setw(12) << "ms"
+            << std::setw(14) << "ns/bytecode" << std::endl;
+
+  for (std::size_t size = 1024; size <= maxSize; size *= 2) {
+    auto program = makeFunction(size);
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(FunctionDef{"bench", program, 0, 1});
+
+    // Take the best of the repetitions, each in a fresh virtual machine.
+    double best = 0;
+    for (std::size_t i = 0; i < repetitions; i++) {
+      VirtualMachine vm{runtime, cfg};
+      vm.load(m);
+      auto start = std::chrono::steady_clock::now();
+      auto code = vm.generateCode(0);
+      auto end = std::chrono::steady_clock::now();
+      if (code == nullptr) {
+        std::cerr << "Failed to compile " << size << " bytecodes" << std::endl;
+        return EXIT_FAILURE;
+      }
+      std::chrono::duration<double, std::milli> ms = end - start;
+      best = i == 0 ? ms.count() : std::min(best, ms.count());
+    }
+
+    std::cout << std::setw(12) << program.size() << std::setw(12)
+              << std::fixed << std::setprecision(2) << best << std::setw(14)
+              << std::setprecision(1) << best * 1e6 / program.size()
+              << std::endl;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,219 @@
+#include <b9/ExecutionContext.hpp>
+#include <b9/VirtualMachine.hpp>
+
+#include <OMR/Om/Runtime.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Microbenchmarks for the interpreter's handlers, calls, transitions into
+/// compiled code, and allocation. Each benchmark runs a hand-built function
+/// bench(), which loops over a body of the operations being measured. The time
+/// of the same loop with an empty body is taken off, leaving the cost of the
+/// operations alone, in nanoseconds. Compile latency is measured by
+/// b9compilebench.
+///
+/// Usage: b9microbench [<iterations>]
+
+using namespace b9;
+
+namespace {
+
+/// Copies of the measured sequence in each iteration of the loop.
+constexpr std::size_t UNROLL = 8;
+
+/// Timed runs of each benchmark. The fastest is reported.
+constexpr std::size_t REPETITIONS = 5;
+
+/// The most iterations of a loop. The count is pushed as a constant, and must
+/// fit in a signed 24 bit immediate.
+constexpr std::size_t MAX_ITERATIONS = 0x7F'FFFF;
+
+/// Build bench(), which runs setup, then loops iterations times over
+/// UNROLL copies of body. Local 0 is the loop counter, and local 1 is free for
+/// the body.
+std::vector<Instruction> makeLoop(const std::vector<Instruction>& setup,
+                                  const std::vector<Instruction>& body,
+                                  std::size_t iterations) {
+  const Immediate size = body.size() * UNROLL;
+  std::vector<Instruction> program = setup;
+  const Immediate count = iterations;
+  program.insert(program.end(), {{OpCode::INT_PUSH_CONSTANT, 0},
+                                 {OpCode::POP_INTO_LOCAL, 0},
+                                 {OpCode::PUSH_FROM_LOCAL, 0},
+                                 {OpCode::INT_PUSH_CONSTANT, count},
+                                 {OpCode::JMP_GE, size + 5}});
+  for (std::size_t i = 0; i < UNROLL; i++) {
+    program.insert(program.end(), body.begin(), body.end());
+  }
+  program.insert(program.end(), {{OpCode::PUSH_FROM_LOCAL, 0},
+                                 {OpCode::INT_PUSH_CONSTANT, 1},
+                                 {OpCode::INT_ADD},
+                                 {OpCode::POP_INTO_LOCAL, 0},
+                                 {OpCode::JMP, -(size + 8)},
+                                 {OpCode::INT_PUSH_CONSTANT, 0},
+                                 {OpCode::FUNCTION_RETURN},
+                                 END_SECTION});
+  return program;
+}
+
+/// A module of bench(), and callee(a, b), which answers a.
+std::shared_ptr<Module> makeModule(const std::vector<Instruction>& setup,
+                                   const std::vector<Instruction>& body,
+                                   std::size_t iterations) {
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(
+      FunctionDef{"bench", makeLoop(setup, body, iterations), 0, 2});
+  std::vector<Instruction> callee = {{OpCode::PUSH_FROM_PARAM, 0},
+                                     {OpCode::FUNCTION_RETURN},
+                                     END_SECTION};
+  m->functions.push_back(FunctionDef{"callee", callee, 2, 0});
+  return m;
+}
+
+/// The fastest run of bench(), in nanoseconds.
+double timeRuns(VirtualMachine& vm) {
+  double best = 0;
+  for (std::size_t i = 0; i < REPETITIONS; i++) {
+    auto start = std::chrono::steady_clock::now();
+    vm.run("bench", {});
+    std::chrono::duration<double, std::nano> ns =
+        std::chrono::steady_clock::now() - start;
+    best = i == 0 ? ns.count() : std::min(best, ns.count());
+  }
+  return best;
+}
+
+/// Runs the benchmarks of one configuration, and prints their costs.
+class Bench {
+ public:
+  Bench(Om::ProcessRuntime& runtime, const Config& cfg, std::string suffix,
+        std::size_t iterations)
+      : runtime_(runtime),
+        cfg_(cfg),
+        suffix_(std::move(suffix)),
+        iterations_(iterations) {
+    baseline_ = time({}, {}, false);
+  }
+
+  /// Print the cost of one copy of body. If compileCallee, callee() runs as
+  /// compiled code.
+  void run(const std::string& name, const std::vector<Instruction>& body,
+           const std::vector<Instruction>& setup = {},
+           bool compileCallee = false) {
+    double ns = time(setup, body, compileCallee) - baseline_;
+    print(name + suffix_, ns / (iterations_ * UNROLL));
+  }
+
+  static void print(const std::string& name, double ns) {
+    std::cout << std::left << std::setw(40) << name << std::right
+              << std::setw(12) << std::fixed << std::setprecision(2) << ns
+              << std::endl;
+  }
+
+ private:
+  double time(const std::vector<Instruction>& setup,
+              const std::vector<Instruction>& body, bool compileCallee) {
+    VirtualMachine vm{runtime_, cfg_};
+    vm.load(makeModule(setup, body, iterations_));
+    if (compileCallee) {
+      vm.setJitAddress(1, vm.generateCode(1));
+    }
+    return timeRuns(vm);
+  }
+
+  Om::ProcessRuntime& runtime_;
+  Config cfg_;
+  std::string suffix_;
+  std::size_t iterations_;
+  double baseline_;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::size_t iterations = 100000;
+  if (argc > 1) {
+    char* end = nullptr;
+    iterations = std::strtoul(argv[1], &end, 0);
+    if (*end != '\0' || iterations == 0 || iterations > MAX_ITERATIONS) {
+      std::cerr << "Usage: b9microbench [<iterations>]" << std::endl
+                << "iterations must be from 1 to " << MAX_ITERATIONS
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  Om::ProcessRuntime runtime;
+
+  const std::vector<Instruction> newObject = {{OpCode::NEW_OBJECT},
+                                              {OpCode::POP_INTO_LOCAL, 1}};
+  const std::vector<Instruction> call = {{OpCode::PUSH_FROM_LOCAL, 0},
+                                         {OpCode::PUSH_FROM_LOCAL, 0},
+                                         {OpCode::FUNCTION_CALL, 1},
+                                         {OpCode::DROP}};
+
+  std::cout << std::left << std::setw(40) << "benchmark" << std::right
+            << std::setw(12) << "ns/op" << std::endl;
+
+  // The handlers, and interpreted calls, in both interpreters.
+  Config threaded;
+  threaded.threaded = true;
+  for (const Config& cfg : {Config(), threaded}) {
+    Bench bench(runtime, cfg, cfg.threaded ? " [threaded]" : "", iterations);
+    bench.run("int_push_constant+drop",
+              {{OpCode::INT_PUSH_CONSTANT, 1}, {OpCode::DROP}});
+    bench.run("push_from_local+duplicate+drop*2",
+              {{OpCode::PUSH_FROM_LOCAL, 0},
+               {OpCode::DUPLICATE},
+               {OpCode::DROP},
+               {OpCode::DROP}});
+    bench.run("push_from_local+pop_into_local",
+              {{OpCode::PUSH_FROM_LOCAL, 0}, {OpCode::POP_INTO_LOCAL, 1}});
+    bench.run("push_from_local*2+int_add+pop",
+              {{OpCode::PUSH_FROM_LOCAL, 0},
+               {OpCode::PUSH_FROM_LOCAL, 0},
+               {OpCode::INT_ADD},
+               {OpCode::POP_INTO_LOCAL, 1}});
+    bench.run("push*2+jmp_eq (not taken)",
+              {{OpCode::PUSH_FROM_LOCAL, 0},
+               {OpCode::INT_PUSH_CONSTANT, -1},
+               {OpCode::JMP_EQ, 0}});
+    bench.run("push_from_local+push_from_object+drop",
+              {{OpCode::PUSH_FROM_LOCAL, 1},
+               {OpCode::PUSH_FROM_OBJECT, 0},
+               {OpCode::DROP}},
+              {{OpCode::NEW_OBJECT},
+               {OpCode::POP_INTO_LOCAL, 1},
+               {OpCode::INT_PUSH_CONSTANT, 0},
+               {OpCode::PUSH_FROM_LOCAL, 1},
+               {OpCode::POP_INTO_OBJECT, 0}});
+    bench.run("new_object+pop_into_local", newObject);
+    bench.run("function_call (2 args)", call);
+  }
+
+  // Calls from the interpreter into compiled code, in each flavour of
+  // callJitFunction.
+  Config jit;
+  jit.jit = true;
+  Config passParam = jit;
+  passParam.directCall = true;
+  passParam.passParam = true;
+  Config lazyVmState = passParam;
+  lazyVmState.lazyVmState = true;
+  Bench(runtime, jit, " [jit]", iterations)
+      .run("function_call to jit", call, {}, true);
+  Bench(runtime, passParam, " [passparam]", iterations)
+      .run("function_call to jit", call, {}, true);
+  Bench(runtime, lazyVmState, " [lazyvmstate]", iterations)
+      .run("function_call to jit", call, {}, true);
+
+  return EXIT_SUCCESS;
+}